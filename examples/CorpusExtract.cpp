@@ -0,0 +1,262 @@
+/*
+
+  Example: extract features of all WAV files on an SD card, on both cores, with resume
+
+  Walks /corpus recursively. Every WAV file (16 bit PCM) gets a feature log next to it,
+  <file>.flog: one row per frame with the spectrum features and the MFCC's, compressed
+  with the FeatureEncoder. Two worker tasks, one per core, each have their own Analyzer.
+  The walker hands them files through a short queue, so memory stays bounded whatever
+  the size of the corpus.
+
+  Resume: the walk order of a FAT directory is stable, so files are numbered in walk
+  order. /corpus.journal holds the number of files below which everything is done (a
+  watermark, appended after every advance). After a reset the walk skips those, only
+  the few files that were in flight are redone.
+
+*/
+
+#include <Arduino.h>
+#include <SD.h>
+#include "SoundAnalyzer.h"
+
+using namespace SoundAnalyzer;
+
+#define CORPUS_ROOT       "/corpus"
+#define CORPUS_JOURNAL    "/corpus.journal"
+#define CORPUS_WORKERS    2
+#define CORPUS_QUEUE      4
+#define CORPUS_WINDOW     16      // > queue + workers: jobs that can be in flight
+#define CORPUS_PATHLEN    128
+#define CORPUS_HOP        256     // frame hop in samples, FFT length 512
+
+struct Job {
+  int32_t     index;              // -1 = stop
+  char        path[CORPUS_PATHLEN];
+};
+
+QueueHandle_t     jobs;
+QueueHandle_t     done;
+
+//=======================================================================
+// Minimal WAV reader: 16 bit PCM, the first channel of each sample frame
+//
+class WavReader {
+public:
+  bool begin(File & f) {
+    file = f;
+    uint8_t hdr[12];
+    if (file.read(hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(&hdr[8], "WAVE", 4)) return false;
+
+    // walk the chunks until data, fmt must come first
+    uint8_t chunk[8];
+    bool fmt = false;
+    while (file.read(chunk, 8) == 8) {
+      uint32_t len = FeatureCodec::get32(&chunk[4]);
+      if (!memcmp(chunk, "fmt ", 4)) {
+        uint8_t f[16];
+        if (len < 16 || file.read(f, 16) != 16) return false;
+        channels   = FeatureCodec::get16(&f[2]);
+        samplefreq = FeatureCodec::get32(&f[4]);
+        fmt = FeatureCodec::get16(&f[0]) == 1 && FeatureCodec::get16(&f[14]) == 16;
+        file.seek(file.position() + len - 16 + (len & 1));
+      } else if (!memcmp(chunk, "data", 4)) {
+        // a bad file must not crash the board: the journal would resume it forever
+        if (!fmt || channels == 0 || samplefreq == 0) return false;
+        remaining = len / (2 * channels);
+        return true;
+      } else {
+        file.seek(file.position() + len + (len & 1));
+      }
+    }
+    return false;
+  }
+
+  // read up to n samples, returns the number read
+  size_t read(int16_t * out, size_t n) {
+    if (n > remaining) n = remaining;
+    for (size_t i = 0; i < n; i++) {
+      int16_t frame[8];
+      size_t bytes = 2 * (channels < 8 ? channels : 8);
+      if (file.read((uint8_t *)frame, bytes) != bytes) {
+        remaining = 0;      // truncated file, nothing more to read
+        return i;
+      }
+      if (channels > 8) file.seek(file.position() + 2 * (channels - 8));
+      out[i] = frame[0];
+    }
+    remaining -= n;
+    return n;
+  }
+
+  unsigned  samplefreq = 0;
+  unsigned  channels = 0;
+  size_t    remaining = 0;
+
+private:
+  File      file;
+};
+
+//=======================================================================
+// one file: frames with a hop of CORPUS_HOP, a feature row per frame
+//
+bool extract(Analyzer<int16_t> & Processor, AnalyzerConfig & Config, const char * path, int16_t * frame, float * row)
+{
+  File in = SD.open(path);
+  WavReader wav;
+  if (!in || !wav.begin(in)) return false;
+
+  if (Config.samplefreq != wav.samplefreq) {
+    Config.samplefreq = wav.samplefreq;
+    Processor.setConfig(Config);
+  }
+  size_t fftlength = Config.fftlength;
+  size_t columns = Processor.NumFeatures + Processor.NumMfccCoeff;
+
+  // peak frequency in Hz, the rest in hundredths
+  float steps[columns];
+  for (size_t c = 0; c < columns; c++) steps[c] = (c == Fpeakfreq) ? 1.0 : 0.01;
+  FeatureEncoder Encoder(columns, steps);
+
+  String name = String(path) + ".flog";
+  File out = SD.open(name, FILE_WRITE);
+  if (!out) return false;
+  Encoder.writeHeader(out);
+
+  // slide: keep the last fftlength - hop samples, read hop new ones
+  size_t have = wav.read(frame, fftlength);
+  while (have == fftlength) {
+    Processor.doFft(frame);
+    Processor.getFeatures(nullptr, 0, row);
+    Processor.getMfcc(nullptr, 0, &row[Processor.NumFeatures]);
+    if (Encoder.addRow(row)) Encoder.writeBlock(out);
+
+    memmove(frame, &frame[CORPUS_HOP], (fftlength - CORPUS_HOP) * sizeof(int16_t));
+    have = fftlength - CORPUS_HOP + wav.read(&frame[fftlength - CORPUS_HOP], CORPUS_HOP);
+  }
+  if (Encoder.flush()) Encoder.writeBlock(out);
+  out.close();
+  return true;
+}
+
+void worker(void * arg)
+{
+  Analyzer<int16_t> Processor;
+  AnalyzerConfig Config = Processor.defaultConfig();
+  int16_t * frame = new int16_t[Config.fftlength];
+  float * row = new float[Processor.NumFeatures + Processor.NumMfccCoeff];
+  Job job;
+
+  for (;;) {
+    xQueueReceive(jobs, &job, portMAX_DELAY);
+    if (job.index < 0) break;
+    if (!extract(Processor, Config, job.path, frame, row))
+      Serial.printf("skipped %s\n", job.path);
+    xQueueSend(done, &job.index, portMAX_DELAY);
+  }
+  delete[] row;
+  delete[] frame;
+  xQueueSend(done, &job.index, portMAX_DELAY);      // -1: this worker stopped
+  vTaskDelete(nullptr);
+}
+
+//=======================================================================
+// walker and journal
+//
+int32_t   next = 0;           // walk index of the next file
+int32_t   watermark = 0;      // all files below are done
+bool      finished[CORPUS_WINDOW];
+
+int32_t readJournal()
+{
+  File j = SD.open(CORPUS_JOURNAL);
+  int32_t last = 0;
+  while (j && j.available()) {
+    String line = j.readStringUntil('\n');
+    if (line.length()) last = line.toInt();
+  }
+  return last;
+}
+
+// collect completions, advance the watermark over the contiguous ones
+void collect(TickType_t wait)
+{
+  int32_t index;
+  bool advanced = false;
+  while (xQueueReceive(done, &index, wait) == pdTRUE) {
+    wait = 0;
+    if (index < 0) continue;
+    finished[index % CORPUS_WINDOW] = true;
+  }
+  while (watermark < next && finished[watermark % CORPUS_WINDOW]) {
+    finished[watermark % CORPUS_WINDOW] = false;
+    watermark++;
+    advanced = true;
+  }
+  if (advanced) {
+    File j = SD.open(CORPUS_JOURNAL, FILE_APPEND);
+    j.printf("%d\n", watermark);
+    j.close();
+  }
+}
+
+void walk(File dir, int32_t resume)
+{
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    String path = f.path();
+    bool isDir = f.isDirectory();
+    f.close();
+
+    if (isDir) { walk(SD.open(path), resume); continue; }
+    if (!path.endsWith(".wav") && !path.endsWith(".WAV")) continue;
+
+    int32_t index = next++;
+    if (index < resume) { watermark = next; continue; }
+
+    // the window must not wrap over files still in flight
+    while (index - watermark >= CORPUS_WINDOW) collect(portMAX_DELAY);
+
+    Job job;
+    job.index = index;
+    strncpy(job.path, path.c_str(), CORPUS_PATHLEN - 1);
+    job.path[CORPUS_PATHLEN - 1] = 0;
+    xQueueSend(jobs, &job, portMAX_DELAY);
+    collect(0);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  if (!SD.begin()) {
+    Serial.println("no SD card");
+    return;
+  }
+
+  jobs = xQueueCreate(CORPUS_QUEUE, sizeof(Job));
+  done = xQueueCreate(CORPUS_WINDOW, sizeof(int32_t));
+  for (int w = 0; w < CORPUS_WORKERS; w++)
+    xTaskCreatePinnedToCore(worker, "extract", 8192, nullptr, 1, nullptr, w);
+
+  int32_t resume = readJournal();
+  Serial.printf("resuming after %d files\n", resume);
+  uint32_t start = millis();
+
+  walk(SD.open(CORPUS_ROOT), resume);
+
+  // stop the workers, wait until both are gone
+  Job stop;
+  stop.index = -1;
+  for (int w = 0; w < CORPUS_WORKERS; w++) xQueueSend(jobs, &stop, portMAX_DELAY);
+  for (int stopped = 0; stopped < CORPUS_WORKERS; ) {
+    int32_t index;
+    xQueueReceive(done, &index, portMAX_DELAY);
+    if (index < 0) stopped++;
+    else finished[index % CORPUS_WINDOW] = true;
+  }
+  collect(0);
+
+  Serial.printf("%d files done, %d new in %lu s\n", watermark, watermark - resume, (millis() - start) / 1000);
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,191 @@
+/*
+
+  Example: how many streams can one ESP32 analyze at a given config
+
+  Per core a generator task synthesizes half of LOAD_STREAMS streams (tones, noise and a
+  speech-like buzz) and feeds them frame by frame into FrameRings, like a sampler would.
+  Two AnalysisHubs, one per core, each analyze those streams with the full plan (level,
+  features, MFCC). The generators run below the hubs and block every tick, so they only
+  get the time the analysis leaves: frames they could not make in time count as late.
+  The rate is stepped up: real time, then 2x, 4x ... until frames drop or are late. Per step the
+  latency from frame arrival to delivered result (p50 / p90 / p99 / max, from the hub
+  latency histograms) and the drops are printed.
+
+  The last step without losses gives the capacity, in real-time streams per core:
+  LOAD_STREAMS * rate / 2.
+
+*/
+
+#include <Arduino.h>
+#include "SoundAnalyzer.h"
+
+using namespace SoundAnalyzer;
+
+#define LOAD_STREAMS      8           // 4 per hub, ANALYSIS_HUB_MAX_STREAMS
+#define LOAD_SAMPLEFREQ   16000
+#define LOAD_FFTLENGTH    512
+#define LOAD_RINGDEPTH    4
+#define LOAD_SECONDS      10          // per step
+#define LOAD_MAXDROP      0.001       // drop fraction that ends the test
+
+FrameRing<int16_t>    *Rings[LOAD_STREAMS];
+AnalysisHub<int16_t>  Hubs[2];
+int                   Ids[LOAD_STREAMS];
+
+//=======================================================================
+// signals. Stream s: s % 3 == 0 tone, 1 noise, 2 speech-like
+//
+struct Synth {
+  float     phase = 0;
+  float     freq;
+  uint32_t  noise;
+  float     y1 = 0, y2 = 0, z1 = 0, z2 = 0;   // two formant resonators
+  uint32_t  n = 0;
+};
+Synth Synths[LOAD_STREAMS];
+
+void synthesize(int s, int16_t * out)
+{
+  Synth & g = Synths[s];
+  const float w = 2 * M_PI / LOAD_SAMPLEFREQ;
+
+  for (int i = 0; i < LOAD_FFTLENGTH; i++, g.n++) {
+    float v;
+    g.noise = g.noise * 1664525 + 1013904223;
+    float white = (int32_t)g.noise / 2147483648.0;
+
+    switch (s % 3) {
+      case 0:   // tone
+        g.phase += w * g.freq;
+        if (g.phase > 2 * M_PI) g.phase -= 2 * M_PI;
+        v = 0.5 * sin(g.phase);
+        break;
+      case 1:   // noise
+        v = 0.3 * white;
+        break;
+      default: {
+        // glottal pulses at freq through resonators at 700 and 1200 Hz, syllables at 4 Hz
+        float pulse = ((g.n % (uint32_t)(LOAD_SAMPLEFREQ / g.freq)) == 0) ? 1.0 : 0.0;
+        float r = 0.97;
+        float y = pulse + 2 * r * cos(w * 700) * g.y1 - r * r * g.y2;
+        g.y2 = g.y1; g.y1 = y;
+        float z = y + 2 * r * cos(w * 1200) * g.z1 - r * r * g.z2;
+        g.z2 = g.z1; g.z1 = z;
+        float envelope = 0.5 + 0.5 * sin(w * 4 * g.n);
+        v = 0.02 * z * envelope + 0.01 * white;
+      }
+    }
+    if (v > 1) v = 1;
+    if (v < -1) v = -1;
+    out[i] = (int16_t)(v * 32767);
+  }
+}
+
+//=======================================================================
+// generator for the streams of one core. Blocks once per tick and catches up on the frames
+// that came due, micros() based, so any tick rate and frame periods below a tick work.
+//
+volatile float  Rate = 1;
+volatile bool   Running = false;
+volatile uint32_t Late[2];
+
+void generator(void * arg)
+{
+  int core = (int)(intptr_t)arg;
+  TickType_t wake = xTaskGetTickCount();
+  uint32_t start = 0, done = 0;
+  bool running = false;
+
+  for (;;) {
+    vTaskDelayUntil(&wake, 1);
+    if (!Running) { running = false; continue; }
+
+    uint32_t now = micros();
+    if (!running) { start = now; done = 0; running = true; }
+    uint32_t due = (double)(now - start) * Rate * LOAD_SAMPLEFREQ / LOAD_FFTLENGTH / 1e6;
+
+    // more than a ring behind: the core is saturated, these frames are lost
+    if (due - done > LOAD_RINGDEPTH) {
+      Late[core] += (due - done - LOAD_RINGDEPTH) * (LOAD_STREAMS / 2);
+      done = due - LOAD_RINGDEPTH;
+    }
+    for (; done < due; done++) {
+      for (int s = core; s < LOAD_STREAMS; s += 2) {
+        int16_t * slot = Rings[s]->acquire();       // a full ring counts a drop
+        if (!slot) continue;
+        synthesize(s, slot);
+        Rings[s]->commit();                         // stamps the arrival
+      }
+    }
+  }
+}
+
+// the hub only analyzes streams with a subscriber, the results themselves are not needed
+void sink(const AnalysisResult &, void *)
+{
+}
+
+void hubTask(void * arg)
+{
+  ((AnalysisHub<int16_t> *)arg)->run();
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  Analyzer<int16_t> Defaults;
+  AnalyzerConfig Config = Defaults.defaultConfig();
+  Config.samplefreq = LOAD_SAMPLEFREQ;
+  Config.fftlength = LOAD_FFTLENGTH;
+
+  for (int s = 0; s < LOAD_STREAMS; s++) {
+    Rings[s] = new FrameRing<int16_t>(LOAD_FFTLENGTH, LOAD_RINGDEPTH);
+    Synths[s].freq = (s % 3 == 2) ? 100 + 20 * s : 200 + 150 * s;
+    Synths[s].noise = 12345 + s;
+
+    AnalysisHub<int16_t> & Hub = Hubs[s % 2];
+    Ids[s] = Hub.addStream(Config, Rings[s]);
+    Hub.subscribe(Ids[s], PlanLevel | PlanFeatures | PlanMfcc, sink);
+  }
+  xTaskCreatePinnedToCore(hubTask, "hub0", 8192, &Hubs[0], 2, nullptr, 0);
+  xTaskCreatePinnedToCore(hubTask, "hub1", 8192, &Hubs[1], 2, nullptr, 1);
+  xTaskCreatePinnedToCore(generator, "generator0", 4096, (void *)0, 1, nullptr, 0);
+  xTaskCreatePinnedToCore(generator, "generator1", 4096, (void *)1, 1, nullptr, 1);
+
+  Serial.printf("%d streams, %d Hz, FFT %d, plan level + features + mfcc\n", LOAD_STREAMS, LOAD_SAMPLEFREQ, LOAD_FFTLENGTH);
+  Serial.println("rate  frames  dropped     late   p50 us   p90 us   p99 us   max us");
+
+  float sustained = 0;
+  for (float rate = 1; rate <= 256; rate *= 2) {
+    // reset the counters, then run the step
+    uint32_t before = 0, dropped = 0;
+    for (int s = 0; s < LOAD_STREAMS; s++) before += Rings[s]->Dropped;
+    uint32_t late = Late[0] + Late[1];
+    Hubs[0].resetLatency();
+    Hubs[1].resetLatency();
+
+    Rate = rate;
+    Running = true;
+    delay(LOAD_SECONDS * 1000);
+    Running = false;
+    delay(200);   // drain
+
+    for (int s = 0; s < LOAD_STREAMS; s++) dropped += Rings[s]->Dropped;
+    dropped -= before;
+    late = Late[0] + Late[1] - late;
+    LatencyHistogram All, Stream;
+    for (int s = 0; s < LOAD_STREAMS; s++)
+      if (Hubs[s % 2].getLatency(Ids[s], LatencyDelivered, Stream)) All.merge(Stream);
+    uint32_t frames = All.Count;
+    Serial.printf("%4.0fx %7u %8u %8u %8u %8u %8u %8u\n", rate, (unsigned)frames, (unsigned)dropped, (unsigned)late,
+                  (unsigned)All.percentile(0.5), (unsigned)All.percentile(0.9), (unsigned)All.percentile(0.99), (unsigned)All.Max);
+
+    if (dropped + late > LOAD_MAXDROP * (frames + dropped + late)) break;
+    sustained = rate;
+  }
+  Serial.printf("capacity: %.0f real-time streams per core at this config\n", LOAD_STREAMS * sustained / 2);
+}
+
+void loop() {
+  delay(1000);
+}
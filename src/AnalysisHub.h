@@ -0,0 +1,323 @@
+//=======================================================================
+/** @file AnalysisHub.h
+ *  @brief One analysis per audio stream, results fanned out to many subscribers
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Several tasks (web, logging, classifier) often need features of the same microphone.
+// Instead of an Analyzer per task, the hub runs one Analyzer per registered stream in its
+// own task and serves the results:
+//  - a stream is a FrameRing of samples plus an AnalyzerConfig
+//  - a subscriber asks for a plan (features, mfcc, signature, pitch, level) and gets the
+//    results through a callback or a FrameRing<AnalysisResult> (see HubClient)
+//  - per frame the plans of all subscribers of a stream are merged, every part is
+//    calculated once and the same result goes to all of them
+//
+//   AnalysisHub<int16_t> Hub;
+//   int mic = Hub.addStream(Config, &Samples);
+//   HubClient<int16_t> Web(Hub, mic, PlanFeatures | PlanLevel);
+//   xTaskCreatePinnedToCore(...) -> Hub.run();
+//   ... in the web task: const AnalysisResult *r = Web.read(); ... Web.done();
+//
+// Latency is traced from the arrival of a frame in the input ring (see FrameRing::commit)
+// and kept per stream in a LatencyHistogram per stage: queued (analysis starts), analyzed
+// (results usable) and delivered (all callbacks returned, all queues filled). A HubClient
+// adds the last step, up to its read(). Query them at runtime with getLatency().
+//
+
+#define ANALYSIS_HUB_MAX_STREAMS        4
+#define ANALYSIS_HUB_MAX_SUBSCRIBERS    8
+#define ANALYSIS_HUB_MAX_MFCC           24      // fixed sizes, so results fit a ring slot
+#define ANALYSIS_HUB_MAX_RANGES         12
+
+enum AnalysisPlan {
+  PlanFeatures = 1, PlanMfcc = 2, PlanSignature = 4, PlanPitch = 8, PlanLevel = 16
+};
+
+enum LatencyStage {
+  LatencyQueued, LatencyAnalyzed, LatencyDelivered, LatencyStages
+};
+
+// results of one frame, only the parts in the plan are valid
+struct AnalysisResult {
+  uint32_t      Frame;
+  uint32_t      Arrival;        // micros() when the frame arrived in the input ring
+  uint8_t       Stream;
+  uint8_t       Plan;
+  decibel_t     Level;
+  float         Pitch;
+  float         Features[ANALYZER_NUMFEATURES];
+  float         Mfccs[ANALYSIS_HUB_MAX_MFCC];
+  signature_t   Signature[ANALYSIS_HUB_MAX_RANGES];
+  hash_t        SignatureHash;
+};
+
+typedef void (*AnalysisCallback)(const AnalysisResult & Result, void * arg);
+
+template <class T>
+class AnalysisHub
+{
+public:
+    AnalysisHub()
+    {
+        lock = xSemaphoreCreateMutex();
+        for (size_t s = 0; s < ANALYSIS_HUB_MAX_STREAMS; s++) streams[s].input = nullptr;
+        for (size_t i = 0; i < ANALYSIS_HUB_MAX_SUBSCRIBERS; i++) subscribers[i].plan = 0;
+    }
+
+    ~AnalysisHub()
+    {
+        for (size_t s = 0; s < ANALYSIS_HUB_MAX_STREAMS; s++)
+            if (streams[s].input) delete streams[s].analyzer;
+        vSemaphoreDelete(lock);
+    }
+
+    //=======================================================================
+    /** register a stream
+     * @param Config analyzer config for the stream, frames are Config.fftlength samples
+     * @param input ring the sampler fills
+     * @returns stream id, -1 if the table is full or the MFCCs / ranges do not fit an AnalysisResult
+     */
+    int addStream(AnalyzerConfig & Config, FrameRing<T> * input)
+    {
+        if (Config.mfcccoeff > ANALYSIS_HUB_MAX_MFCC || Config.numranges > ANALYSIS_HUB_MAX_RANGES) {
+            log_e("AnalysisHub: %u mfcc / %u ranges, at most %u / %u", (unsigned)Config.mfcccoeff,
+                  (unsigned)Config.numranges, ANALYSIS_HUB_MAX_MFCC, ANALYSIS_HUB_MAX_RANGES);
+            return -1;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int id = -1;
+        for (size_t s = 0; s < ANALYSIS_HUB_MAX_STREAMS && id < 0; s++) {
+            if (streams[s].input) continue;
+            streams[s].analyzer = new Analyzer<T>(Config);
+            streams[s].frame = 0;
+            streams[s].input = input;
+            id = s;
+        }
+        xSemaphoreGive(lock);
+        return id;
+    }
+
+    /** subscribe with a result ring, a full ring skips the frame for that subscriber only
+     * @returns subscriber id, -1 if the table is full */
+    int subscribe(int stream, uint8_t plan, FrameRing<AnalysisResult> * queue)
+    {
+        return add(stream, plan, queue, nullptr, nullptr);
+    }
+
+    /** subscribe with a callback, called from the hub task: keep it short and do not
+     * (un)subscribe from within it */
+    int subscribe(int stream, uint8_t plan, AnalysisCallback callback, void * arg = nullptr)
+    {
+        return add(stream, plan, nullptr, callback, arg);
+    }
+
+    /** after this returns the hub no longer touches the subscriber's ring */
+    void unsubscribe(int id)
+    {
+        if (id < 0 || id >= ANALYSIS_HUB_MAX_SUBSCRIBERS) return;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        subscribers[id].plan = 0;
+        xSemaphoreGive(lock);
+    }
+
+    //=======================================================================
+    /** analyze all frames that are waiting, without blocking
+     * @returns the number of frames processed
+     */
+    size_t poll()
+    {
+        size_t count = 0;
+        for (size_t s = 0; s < ANALYSIS_HUB_MAX_STREAMS; s++) {
+            Stream &st = streams[s];
+            if (!st.input) continue;
+
+            const T * frame;
+            while ((frame = st.input->peek()) != nullptr) {
+                xSemaphoreTake(lock, portMAX_DELAY);
+                process(s, frame, st.input->arrival());
+                xSemaphoreGive(lock);
+                st.input->release();
+                st.frame++;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    /** the hub task body: sleeps until any stream commits a frame */
+    void run()
+    {
+        for (;;) {
+            if (poll() == 0) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    //=======================================================================
+    /** copy of the latency histogram of a stream and stage, from any task
+     * @returns false for an unknown stream
+     */
+    bool getLatency(int stream, LatencyStage stage, LatencyHistogram & out)
+    {
+        if (stream < 0 || stream >= ANALYSIS_HUB_MAX_STREAMS || stage >= LatencyStages) return false;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool known = streams[stream].input != nullptr;
+        if (known) out = streams[stream].latency[stage];
+        xSemaphoreGive(lock);
+        return known;
+    }
+
+    /** restart the histograms of one stream, or of all with -1 */
+    void resetLatency(int stream = -1)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        for (size_t s = 0; s < ANALYSIS_HUB_MAX_STREAMS; s++)
+            if (stream < 0 || (size_t)stream == s)
+                for (size_t i = 0; i < LatencyStages; i++) streams[s].latency[i].reset();
+        xSemaphoreGive(lock);
+    }
+
+    /** frames not delivered because a subscriber ring was full */
+    uint32_t        Skipped = 0;
+
+private:
+    struct Stream {
+        FrameRing<T>    *input;
+        Analyzer<T>     *analyzer;
+        uint32_t        frame;
+        LatencyHistogram latency[LatencyStages];
+    };
+
+    struct Subscriber {
+        uint8_t         plan;           // 0 = free
+        uint8_t         stream;
+        FrameRing<AnalysisResult> *queue;
+        AnalysisCallback callback;
+        void            *arg;
+    };
+
+    int add(int stream, uint8_t plan, FrameRing<AnalysisResult> * queue, AnalysisCallback callback, void * arg)
+    {
+        if (stream < 0 || stream >= ANALYSIS_HUB_MAX_STREAMS || !streams[stream].input || plan == 0) return -1;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int id = -1;
+        for (size_t i = 0; i < ANALYSIS_HUB_MAX_SUBSCRIBERS && id < 0; i++) {
+            if (subscribers[i].plan) continue;
+            subscribers[i].stream = stream;
+            subscribers[i].queue = queue;
+            subscribers[i].callback = callback;
+            subscribers[i].arg = arg;
+            subscribers[i].plan = plan;
+            id = i;
+        }
+        xSemaphoreGive(lock);
+        return id;
+    }
+
+    // merged plan of the stream, each part once, then fan out
+    void process(size_t s, const T * frame, uint32_t arrival)
+    {
+        uint8_t plan = 0;
+        for (size_t i = 0; i < ANALYSIS_HUB_MAX_SUBSCRIBERS; i++)
+            if (subscribers[i].plan && subscribers[i].stream == s) plan |= subscribers[i].plan;
+        if (plan == 0) return;
+
+        LatencyHistogram *latency = streams[s].latency;
+        latency[LatencyQueued].record(micros() - arrival);
+
+        Analyzer<T> &A = *streams[s].analyzer;
+        AnalysisResult &R = result;
+        R.Frame = streams[s].frame;
+        R.Arrival = arrival;
+        R.Stream = s;
+        R.Plan = plan;
+
+        if (plan & PlanLevel) R.Level = A.decibelSPL(frame);
+        if (plan & (PlanFeatures | PlanMfcc | PlanSignature)) {
+            A.doFft(frame);
+            if (plan & PlanFeatures) A.getFeatures(nullptr, 0, R.Features);
+            // addStream checked that both fit
+            if (plan & PlanMfcc) A.getMfcc(nullptr, 0, R.Mfccs);
+            if (plan & PlanSignature) {
+                A.getSignature(nullptr, 0, R.Signature);
+                R.SignatureHash = A.getSignatureHash(R.Signature);
+            }
+        }
+        // last, the pitch reuses the signal buffer of the FFT
+        if (plan & PlanPitch) R.Pitch = A.getPitch(frame);
+        latency[LatencyAnalyzed].record(micros() - arrival);
+
+        for (size_t i = 0; i < ANALYSIS_HUB_MAX_SUBSCRIBERS; i++) {
+            Subscriber &sub = subscribers[i];
+            if (!sub.plan || sub.stream != s) continue;
+
+            if (sub.callback) {
+                sub.callback(R, sub.arg);
+            } else {
+                AnalysisResult *slot = sub.queue->acquire();
+                if (!slot) { Skipped++; continue; }
+                *slot = R;
+                sub.queue->commit();
+            }
+        }
+        latency[LatencyDelivered].record(micros() - arrival);
+    }
+
+    Stream          streams[ANALYSIS_HUB_MAX_STREAMS];
+    Subscriber      subscribers[ANALYSIS_HUB_MAX_SUBSCRIBERS];
+    AnalysisResult  result;
+    SemaphoreHandle_t lock;
+};
+
+//=======================================================================
+// a subscriber with its own result ring, for tasks and tests
+//
+template <class T>
+class HubClient
+{
+public:
+    HubClient(AnalysisHub<T> & hub_, int stream, uint8_t plan, size_t depth = 4) :
+            hub(hub_), queue(1, depth + 1)
+    {
+        Id = hub.subscribe(stream, plan, &queue);
+    }
+
+    ~HubClient()
+    {
+        hub.unsubscribe(Id);
+    }
+
+    /** the next result, nullptr on timeout. Call done() when finished with it */
+    const AnalysisResult * read(TickType_t timeout = portMAX_DELAY)
+    {
+        const AnalysisResult *r = queue.wait(timeout);
+        if (r) Latency.record(micros() - r->Arrival);
+        return r;
+    }
+    void done()                                                     { queue.release(); }
+
+    /** subscriber id, -1 if the subscription failed */
+    int             Id;
+    /** frame arrival to read(), only touched by the reading task */
+    LatencyHistogram Latency;
+
+private:
+    AnalysisHub<T>  &hub;
+    FrameRing<AnalysisResult> queue;
+};
@@ -65,6 +65,22 @@ AnalyzerConfig & Analyzer<T>::defaultConfig()
 
     // Mfcc parameters coeff 0 = switch off, default = 13
     .mfcccoeff   = ANALYZER_DEFAULT_MFCC_COEFF,
+    .filterbank  = ANALYZER_DEFAULT_FILTERBANK,
+
+    // LPC order 0 = switch off
+    .lpcorder    = ANALYZER_DEFAULT_LPC_ORDER,
+
+    // Wavelet levels 0 = switch off
+    .dwtlevels   = ANALYZER_DEFAULT_DWT_LEVELS,
+    .wavelet     = ANALYZER_DEFAULT_WAVELET,
+
+    // Cepstrum peaks 0 = switch off
+    .cepstrumpeaks = ANALYZER_DEFAULT_CEPSTRUM_PEAKS,
+
+    // Input conversion, defaults leave the samples as they are
+    .inputshift  = ANALYZER_DEFAULT_INPUT_SHIFT,
+    .inputoffset = ANALYZER_DEFAULT_INPUT_OFFSET,
+    .inputscale  = ANALYZER_DEFAULT_INPUT_SCALE,
     
   };
 
@@ -78,7 +94,10 @@ void Analyzer<T>::setConfig(AnalyzerConfig & newCfg)
   // resize and re-init if relevant parameters have changed
   if (initialized) {
     if (newCfg.fftlength != Config.fftlength ||  newCfg.samplefreq != Config.samplefreq ||
-        newCfg.numranges != Config.numranges ||  newCfg.mfcccoeff != Config.mfcccoeff) 
+        newCfg.numranges != Config.numranges ||  newCfg.mfcccoeff != Config.mfcccoeff ||
+        newCfg.filterbank != Config.filterbank || newCfg.lpcorder != Config.lpcorder ||
+        newCfg.dwtlevels != Config.dwtlevels || newCfg.wavelet != Config.wavelet ||
+        newCfg.cepstrumpeaks != Config.cepstrumpeaks) 
     {
       End();
     }
@@ -90,6 +109,7 @@ void Analyzer<T>::setConfig(AnalyzerConfig & newCfg)
   NumBins = Config.fftlength/2;
   SignatureLen = Config.numranges;
   NumMfccCoeff = Config.mfcccoeff;
+  NumLpcCoeff = Config.lpcorder ? Config.lpcorder + 1 : 0;
 
   // CHeck shazam config: if we still have the default range but another fftlength,
   // that won;t work. So help the caller: create an adapted list
@@ -132,6 +152,9 @@ bool Analyzer<T>::Begin()
   size_t  samplefreq = Config.samplefreq;
   size_t  mfcccoeff = Config.mfcccoeff;
   size_t  numranges = Config.numranges;
+  size_t  lpcorder = Config.lpcorder;
+  size_t  dwtlevels = Config.dwtlevels;
+  size_t  cepstrumpeaks = Config.cepstrumpeaks;
 
   if (initialized)  return true;
 
@@ -154,7 +177,7 @@ bool Analyzer<T>::Begin()
 
   if (mfcccoeff > 0 && memok)
   {
-    mfcc = new MFCC(fftlength,samplefreq,mfcccoeff);
+    mfcc = new MFCC(fftlength,samplefreq,mfcccoeff,Config.filterbank);
     Mfccs = mfcc->MFCCs;
 
     memok = mfcc;
@@ -173,6 +196,40 @@ bool Analyzer<T>::Begin()
     memok = yin ;
   }
 
+  if (lpcorder > 0 && memok)
+  {
+    lpc = new LPC(lpcorder,samplefreq);
+    LpcCoeffs = lpc->Coeffs;
+    LpcCepstra = lpc->Cepstra;
+    Formants = lpc->Formants;
+    NumFormants = 0;
+
+    memok = lpc;
+  }
+
+  // the transform runs in the signal buffer, only the band energies need memory
+  if (dwtlevels > 0 && memok)
+  {
+    dwt = new DWT(fftlength,dwtlevels,Config.wavelet);
+    NumWaveletBands = dwt->levels + 1;
+    WaveletEnergies = new float[NumWaveletBands];
+    WaveletCoeffs = signal;
+
+    memok = dwt && WaveletEnergies;
+  }
+
+  if (cepstrumpeaks > 0 && memok)
+  {
+    cepstrum = new RealCepstrum(fftlength,samplefreq,cepstrumpeaks);
+    CepstrumCoeffs = cepstrum->Coeffs;
+    NumCepstrumCoeff = cepstrum->NumCoeffs;
+    CepstrumPeaks = cepstrum->PeakQuefrency;
+    CepstrumPeakValues = cepstrum->PeakValue;
+    NumCepstrumPeaks = 0;
+
+    memok = cepstrum;
+  }
+
   if (!memok ) 
   {
     log_e("Can't allocate memory for soundAnalyzer");
@@ -193,10 +250,22 @@ void Analyzer<T>::End() {
     if (FFT)        { delete FFT;           FFT = nullptr ;}
     if (mfcc)       { delete mfcc;          mfcc = nullptr ;}
     if (yin)        { delete yin;           yin = nullptr; }
+    if (lpc)        { delete lpc;           lpc = nullptr; }
+    if (dwt)        { delete dwt;           dwt = nullptr; }
+    if (cepstrum)   { delete cepstrum;      cepstrum = nullptr; }
+    if (WaveletEnergies) { delete[] WaveletEnergies; WaveletEnergies = nullptr; }
 
     initialized = false;
 }
 
+// Convert raw samples to float: shift, offset and scale from the config.
+// One loop without branches, so the compiler can unroll / pipeline it
+template <class T>
+void Analyzer<T>::convert(const T * Signal, float * out, unsigned len)
+{
+  for (unsigned i = 0; i < len; i++) out[i] = sample(Signal[i]);
+}
+
 // Calc RMS of the signal, rule out any DC
 //
 template <class T>
@@ -206,7 +275,7 @@ float Analyzer<T>::rms(const T * Signal, unsigned siglen) {
 
   double Rms = 0; 
   for (unsigned i = 0; i < len; i++) {
-    float amp = fabs((float)Signal[i]) ;
+    float amp = fabs(sample(Signal[i])) ;
     Rms += sq(amp);
   }    
   Rms /= len;  // mean
@@ -247,9 +316,7 @@ template <class T>
 void Analyzer<T>::doFft(const T * Signal,bool removeDC)
 {
     // copy samples to locall, because Hamming alters our data
-    for (unsigned i=0; i < Config.fftlength ; i++) {
-      signal[i] = (float)(Signal[i]); 
-    }
+    convert(Signal, signal, Config.fftlength);
     // now do FFT
     FFT->hammingWindow();
     if (removeDC) FFT->removeDC();
@@ -272,6 +339,13 @@ void Analyzer<T>::doFft(const T * Signal,bool removeDC)
 //
 template <class T>
 signature_t * Analyzer<T>::getSignature(const float * Spectrum, unsigned len)
+{
+  return getSignature(Spectrum, len, Signature);
+}
+
+// Same, into a caller buffer of SignatureLen entries, e.g. a row of a frame record
+template <class T>
+signature_t * Analyzer<T>::getSignature(const float * Spectrum, unsigned len, signature_t * Out)
 {
   const float * bins;
   unsigned NumBins;
@@ -286,7 +360,7 @@ signature_t * Analyzer<T>::getSignature(const float * Spectrum, unsigned len)
   float mags[numranges];
   for (unsigned i=0; i<numranges; i++ )
   {
-    Signature[i] = 0;
+    Out[i] = 0;
     mags[i] = 0;
   }
 
@@ -308,7 +382,7 @@ signature_t * Analyzer<T>::getSignature(const float * Spectrum, unsigned len)
       mag = log(fabs(bins[i]) +1);   
     // keep the actual frequency of peak value in each range
     if (mag > mags[r]) {
-      Signature[r] = (signature_t) int(frequency(i));
+      Out[r] = (signature_t) int(frequency(i));
       mags[r] = mag;
     }
   }
@@ -316,9 +390,9 @@ signature_t * Analyzer<T>::getSignature(const float * Spectrum, unsigned len)
   for (i=0, avg=0; i<numranges; i++) avg += mags[i];
   avg = (avg * 1.0) /i;
   for (i=0; i<numranges; i++) 
-    if (mags[i] < avg) Signature[i] = 0;
+    if (mags[i] < avg) Out[i] = 0;
     
-  return Signature;
+  return Out;
 }
 
 // return a hash of the signature.
@@ -335,6 +409,13 @@ hash_t Analyzer<T>::getSignatureHash(const signature_t * Sig)
 //
 template <class T>
 float * Analyzer<T>::getFeatures(const float * Spectrum, unsigned len)
+{
+  return getFeatures(Spectrum, len, Features);
+}
+
+// Same, into a caller buffer of NumFeatures floats. Results stay valid across frames
+template <class T>
+float * Analyzer<T>::getFeatures(const float * Spectrum, unsigned len, float * Out)
 {
   const float * bins;
   unsigned NumBins;
@@ -390,14 +471,14 @@ float * Analyzer<T>::getFeatures(const float * Spectrum, unsigned len)
   meanVal = sumAmplitudes / (double)NumBins;
   meancVal = sumcVal / (double)NumBins;
 
-  Features[Fpeakfreq] = (float) peakFreq;
-  Features[Fpeakmag]  = (float) peakMag;
-  Features[Favgmag]   = (float) meanVal;
+  Out[Fpeakfreq] = (float) peakFreq;
+  Out[Fpeakmag]  = (float) peakMag;
+  Out[Favgmag]   = (float) meanVal;
   
   float centroid = sumAmplitudes > 0 ? sumWeightedAmplitudes / sumAmplitudes : 0.0;
-  Features[Fcentroid] = (float) centroid;
-  Features[Fflatness] = (float) (sumfVal > 0 ? exp (logSumfVal) / sumfVal : 0.0);
-  Features[Fcrest]    = (float) (sumcVal > 0 ? maxcVal / meancVal : 1.0);
+  Out[Fcentroid] = (float) centroid;
+  Out[Fflatness] = (float) (sumfVal > 0 ? exp (logSumfVal) / sumfVal : 0.0);
+  Out[Fcrest]    = (float) (sumcVal > 0 ? maxcVal / meancVal : 1.0);
 
   // for kurtosis
   float moment2 = 0;
@@ -430,22 +511,29 @@ float * Analyzer<T>::getFeatures(const float * Spectrum, unsigned len)
     moment2 += squaredDifference;
     moment4 += sq(squaredDifference);
   }
-  Features[Frolloff] = rolloff;
+  Out[Frolloff] = rolloff;
 
   float spread = sqrt(spread_sum / sumAmplitudes); // = weighted std. deviation
-  Features[Fspread] = (float) spread;
-  Features[Fskewness] = (float) ((skewness_sum / sumAmplitudes) / pow(spread,3));
+  Out[Fspread] = (float) spread;
+  Out[Fskewness] = (float) ((skewness_sum / sumAmplitudes) / pow(spread,3));
   
   moment2 = moment2 / NumBins;
   moment4 = moment4 / NumBins;    
-  Features[Fkurtosis] = (moment2 == 0 ? -3 : (moment4 / sq(moment2)) - 3.0);
+  Out[Fkurtosis] = (moment2 == 0 ? -3 : (moment4 / sq(moment2)) - 3.0);
 
-  return Features;
+  return Out;
 
 }
 // Make cepstrals. Make sure firstbin is empty
 template <class T>
 float * Analyzer<T>::getMfcc(const float * Spectrum, unsigned len)
+{
+  return getMfcc(Spectrum, len, mfcc ? mfcc->MFCCs : nullptr);
+}
+
+// Same, into a caller buffer of NumMfccCoeff floats
+template <class T>
+float * Analyzer<T>::getMfcc(const float * Spectrum, unsigned len, float * Out)
 {
   const float * bins;
   unsigned NumBins;
@@ -455,9 +543,8 @@ float * Analyzer<T>::getMfcc(const float * Spectrum, unsigned len)
   NumBins = (len == 0) ? this->NumBins : len;
 
   if (Config.mfcccoeff > 0 ) {
-    mfcc->calculateMelFrequencyCepstralCoefficients (bins);
-    Mfccs = mfcc->MFCCs;
-    return Mfccs;
+    mfcc->calculateMelFrequencyCepstralCoefficients (bins, Out);
+    return Out;
   }  else 
     return nullptr;
 }
@@ -467,8 +554,87 @@ float * Analyzer<T>::getMfcc(const float * Spectrum, unsigned len)
 template <class T>
 float  Analyzer<T>::getPitch(const T * Signal)
 {
-  for (unsigned i=0; i<Config.fftlength; i++) signal[i] = (float)Signal[i];
+  convert(Signal, signal, Config.fftlength);
   return yin->pitchYin(signal);
 }
 
+// Linear prediction. Without a signal we take the windowed frame that doFft left in
+// the signal buffer (the FFT does not alter its input), so no second conversion. Then
+// getLpc() must follow doFft directly: getPitch / getWavelet overwrite that buffer.
+// With a signal it is converted and windowed the same way. Also makes the LPC cepstra
+template <class T>
+float * Analyzer<T>::getLpc(const T * Signal)
+{
+  if (Config.lpcorder == 0) return nullptr;
+
+  if (Signal != nullptr) {
+    convert(Signal, signal, Config.fftlength);
+    FFT->hammingWindow();
+  }
+  NumFormants = 0;
+  if (!lpc->calculate(signal, Config.fftlength)) return nullptr;
+  return LpcCoeffs;
+}
+
+// Formants from the last getLpc(), root finding so relatively expensive
+template <class T>
+float * Analyzer<T>::getFormants()
+{
+  if (Config.lpcorder == 0) return nullptr;
+
+  NumFormants = lpc->calculateFormants();
+  return Formants;
+}
+
+// Wavelet transform, for transients. Time domain like getPitch: converts into the
+// signal buffer and transforms in place. The coefficients stay in WaveletCoeffs
+// until the next doFft / getPitch
+template <class T>
+float * Analyzer<T>::getWavelet(const T * Signal)
+{
+  if (Config.dwtlevels == 0) return nullptr;
+
+  convert(Signal, signal, Config.fftlength);
+  dwt->forward(signal);
+  dwt->bandEnergies(signal, WaveletEnergies);
+  return WaveletEnergies;
+}
+
+// Real cepstrum of the spectrum: one extra inverse real FFT, logs with a fast approximation.
+// The FFT is sized for NumBins, a spectrum of another length is refused
+template <class T>
+float * Analyzer<T>::getCepstrum(const float * Spectrum, unsigned len)
+{
+  if (Config.cepstrumpeaks == 0) return nullptr;
+  if (len != 0 && len != NumBins) return nullptr;
+
+  // Use parameter or existing data?
+  const float * bins = (Spectrum != nullptr) ? Spectrum : spectrum;
+
+  cepstrum->calculate(bins);
+  NumCepstrumPeaks = cepstrum->NumPeaks;
+  return CepstrumCoeffs;
+}
+
+// Batch analysis of a recording, for offline / host use. The frames are read in place:
+// with hop < fftlength they overlap in one contiguous signal, no copies. Results go in
+// row major matrices of NumFeatures, NumMfccCoeff and SignatureLen columns, ready for
+// numpy (np.frombuffer(...).reshape(frames, columns)) or a model input.
+template <class T>
+size_t Analyzer<T>::analyzeBatch(const T * Frames, size_t numFrames, size_t hop, float * FeatureMatrix,
+                                 float * MfccMatrix, signature_t * SignatureMatrix)
+{
+  if (hop == 0) hop = Config.fftlength;
+  if (Config.mfcccoeff == 0) MfccMatrix = nullptr;
+  if (Config.numranges == 0) SignatureMatrix = nullptr;
+
+  for (size_t i = 0; i < numFrames; i++) {
+    doFft(&Frames[i * hop]);
+    if (FeatureMatrix)   getFeatures(nullptr, 0, &FeatureMatrix[i * NumFeatures]);
+    if (MfccMatrix)      getMfcc(nullptr, 0, &MfccMatrix[i * NumMfccCoeff]);
+    if (SignatureMatrix) getSignature(nullptr, 0, &SignatureMatrix[i * SignatureLen]);
+  }
+  return numFrames;
+}
+
 }
@@ -10,6 +10,16 @@ typedef unsigned short  signature_t;
 typedef unsigned short  decibel_t;
 typedef unsigned long   hash_t;
 
+// packed 24 bit sample, little endian, as some I2S codecs deliver in 3 byte slots
+struct packed24_t {
+  uint8_t     b[3];
+  operator int32_t() const { return (int32_t)((uint32_t)b[0] << 8 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 24) >> 8; }
+};
+
+// Version of the feature calculations. Bump it whenever a change alters any result,
+// stored results (ResultCache) of older versions are then recalculated
+#define ANALYZER_FEATURE_VERSION 1
+
 // Defaults for DecibelSPL
 // set for a MAX4466
 #define ANALYZER_DEFAULT_GAIN 75          // calibration value for microphone Gain
@@ -36,6 +46,35 @@ typedef unsigned long   hash_t;
 
 // Default For MFCC
 #define ANALYZER_DEFAULT_MFCC_COEFF 13
+#define ANALYZER_DEFAULT_FILTERBANK MelScale
+
+// Filterbank for the cepstral coefficients: mel triangles (MFCC),
+// or gammatone weights on a Bark (BFCC) or ERB (GFCC) spaced scale
+enum FilterbankScale {
+  MelScale=0, BarkScale, ErbScale
+};
+
+// Default for the wavelet transform: off. Max levels is log2(fftlength) - 1
+#define ANALYZER_DEFAULT_DWT_LEVELS 0
+#define ANALYZER_DEFAULT_WAVELET    Daubechies4
+
+enum WaveletType {
+  HaarWavelet=0, Daubechies4
+};
+
+// Default for the cepstrum: off, else the number of quefrency peaks
+#define ANALYZER_DEFAULT_CEPSTRUM_PEAKS 0
+
+// Default for LPC: off. Rule of thumb for speech is 2 + samplefreq / 1000
+#define ANALYZER_DEFAULT_LPC_ORDER  0
+
+// Input conversion, applied to every sample before analysis:
+//   ((sample >> inputshift) - inputoffset) * inputscale
+// The defaults change nothing. E.g. 24 bit I2S in 32 bit slots: shift 8.
+// A 12 bit ESP32 ADC: offset 2048, scale 3300/4096 for mV. Floats are never shifted
+#define ANALYZER_DEFAULT_INPUT_SHIFT   0
+#define ANALYZER_DEFAULT_INPUT_OFFSET  0
+#define ANALYZER_DEFAULT_INPUT_SCALE   1.0
 
 // a factor that roughly applies to our FFT + Hamming.
 // to find the amplitude for a given (real) magnitude
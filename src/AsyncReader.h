@@ -0,0 +1,188 @@
+//=======================================================================
+/** @file AsyncReader.h
+ *  @brief Read ahead task for bulk file analysis, overlaps SD / flash reads with the FFT
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// With a plain read / analyze loop the SD card idles during the FFT and the CPU idles
+// during the read. The AsyncReader runs the reads in its own task (best on the other
+// core) and keeps a pool of numBlocks buffers filled ahead of the analyzer:
+//
+//   AsyncReader Reader(SD, 4096, 4);
+//   Reader.begin();
+//   Reader.submit("/rec/a.wav", 1);  Reader.submit("/rec/b.wav", 2);
+//   while ((block = Reader.next()) != nullptr) {  ... block->Data, block->Length ...;  Reader.release(); }
+//
+// The pool is a FrameRing of blocks, so a block is read into its buffer once and analyzed
+// in place. Up to ASYNCREADER_REQUESTS files can be queued, blocks come back in request order.
+// A block of a multiple of the frame size (in bytes) keeps frames within one block.
+//
+// end() does not drain: it drops the queued requests, aborts the file being read and
+// discards the blocks not yet consumed. A block from next() is invalid after end().
+//
+
+#define ASYNCREADER_MAXPATH     96
+#define ASYNCREADER_REQUESTS    8
+#define ASYNCREADER_STACK       4096
+
+// a block of a file, Last is set on the final block (Length can be 0, e.g. a missing file)
+struct ReadBlock {
+  uint32_t      File;           // id given to submit()
+  uint32_t      Offset;         // in the file
+  uint32_t      Length;         // valid bytes in Data
+  uint16_t      Last;
+  uint16_t      Error;          // the file could not be opened or read
+  uint8_t       *Data;          // the bytes, in the same pool slot right after this header
+};
+
+class AsyncReader
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param fs_ filesystem to read from
+     * @param blockSize_ bytes per read
+     * @param numBlocks buffers in the pool, numBlocks - 1 can be ahead of the consumer
+     */
+    AsyncReader(fs::FS &fs_, size_t blockSize_ = 4096, size_t numBlocks = 4) :
+            BlockSize(blockSize_), fs(fs_), pool(sizeof(ReadBlock) + blockSize_, numBlocks)
+    {
+        requests = xQueueCreate(ASYNCREADER_REQUESTS, sizeof(Request));
+    }
+
+    ~AsyncReader()
+    {
+        end();
+        vQueueDelete(requests);
+    }
+
+    /** start the read task */
+    bool begin(UBaseType_t priority = 1, BaseType_t core = 0)
+    {
+        if (running) return true;
+        stopping = false;
+        running = true;
+        running = xTaskCreatePinnedToCore(readTask, "asyncreader", ASYNCREADER_STACK, this, priority, &task, core) == pdPASS;
+        return running;
+    }
+
+    /** stop the read task now: pending requests and unread blocks are dropped */
+    void end()
+    {
+        if (!running) return;
+        stopping = true;
+        xQueueReset(requests);
+        Request stop;
+        stop.path[0] = 0;
+        xQueueSend(requests, &stop, portMAX_DELAY);
+        xTaskNotifyGive(task);
+        while (running) vTaskDelay(1);
+
+        while (pool.peek()) pool.release();
+    }
+
+    /** queue a file, waits if ASYNCREADER_REQUESTS are queued already */
+    bool submit(const char *path, uint32_t id, TickType_t timeout = portMAX_DELAY)
+    {
+        Request r;
+        r.id = id;
+        strncpy(r.path, path, ASYNCREADER_MAXPATH - 1);
+        r.path[ASYNCREADER_MAXPATH - 1] = 0;
+        if (r.path[0] == 0) return false;
+        return xQueueSend(requests, &r, timeout) == pdTRUE;
+    }
+
+    //=======================================================================
+    /** the next block, in request order, nullptr on timeout */
+    const ReadBlock * next(TickType_t timeout = portMAX_DELAY)
+    {
+        return (const ReadBlock *)pool.wait(timeout);
+    }
+
+    /** done with the block from next(), its buffer goes back to the reader */
+    void release()
+    {
+        pool.release();
+        if (running) xTaskNotifyGive(task);
+    }
+
+    size_t          BlockSize;
+    /** time the reader waited for a free buffer: the analysis is the bottleneck */
+    uint32_t        StallMicros = 0;
+
+private:
+    struct Request {
+        uint32_t    id;
+        char        path[ASYNCREADER_MAXPATH];
+    };
+
+    static void readTask(void *arg)
+    {
+        AsyncReader *self = (AsyncReader *)arg;
+        Request r;
+        for (;;) {
+            xQueueReceive(self->requests, &r, portMAX_DELAY);
+            if (r.path[0] == 0 || self->stopping) break;
+            self->readFile(r);
+        }
+        self->running = false;
+        vTaskDelete(nullptr);
+    }
+
+    // back pressure: wait for a free buffer, never drop a block. nullptr when stopping
+    ReadBlock * freeBlock()
+    {
+        if (pool.full()) {
+            uint32_t start = micros();
+            while (pool.full() && !stopping) ulTaskNotifyTake(pdTRUE, 1);
+            StallMicros += micros() - start;
+        }
+        if (stopping) return nullptr;
+        ReadBlock *b = (ReadBlock *)pool.acquire();
+        b->Data = (uint8_t *)b + sizeof(ReadBlock);
+        return b;
+    }
+
+    void readFile(const Request &r)
+    {
+        fs::File f = fs.open(r.path, FILE_READ);
+        uint32_t offset = 0;
+        bool last = false;
+
+        while (!last) {
+            ReadBlock *b = freeBlock();
+            if (!b) break;
+            b->File = r.id;
+            b->Offset = offset;
+            b->Error = !f;
+            b->Length = f ? f.read(b->Data, BlockSize) : 0;
+            last = b->Length < BlockSize || !f.available();
+            b->Last = last;
+            offset += b->Length;
+            pool.commit();
+        }
+        if (f) f.close();
+    }
+
+    fs::FS          &fs;
+    FrameRing<uint8_t> pool;
+    QueueHandle_t   requests;
+    TaskHandle_t    task = nullptr;
+    volatile bool   running = false;
+    volatile bool   stopping = false;
+};
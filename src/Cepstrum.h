@@ -0,0 +1,153 @@
+//=======================================================================
+/** @file Cepstrum.h
+ *  @brief Real cepstrum and quefrency peaks
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// The real cepstrum is the inverse FFT of the log magnitude spectrum. The log magnitude
+// is real and even, so it goes through a real inverse FFT in the packed layout
+// [DC, Nyquist, re1, 0, re2, 0 ...], which internally is a half size complex FFT.
+// Rahmonics (gear mesh, echoes, pitch) show up as peaks at their period (quefrency).
+//
+
+#define CEPSTRUM_FLOOR          1e-5        // log floor relative to the peak magnitude (-100 dB)
+#define CEPSTRUM_MIN_FREQ       40.0        // quefrency range searched for peaks, as frequencies
+#define CEPSTRUM_MAX_FREQ       1000.0
+
+class RealCepstrum
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param fftlength_ the FFT length of the spectrum
+     * @param samplefreq_ the sampling frequency
+     * @param numPeaks_ the number of quefrency peaks to find
+     */
+    RealCepstrum(size_t fftlength_, size_t samplefreq_, size_t numPeaks_,
+                 float minFreq = CEPSTRUM_MIN_FREQ, float maxFreq = CEPSTRUM_MAX_FREQ) :
+            fftlength(fftlength_), samplefreq(samplefreq_), numPeaks(numPeaks_)
+    {
+        NumCoeffs = fftlength / 2;
+        input = new float[fftlength];
+        output = new float[fftlength];
+        PeakQuefrency = new float[numPeaks];
+        PeakValue = new float[numPeaks];
+        FFT = new ESP_fft(fftlength, samplefreq, FFT_REAL, FFT_BACKWARD, input, output);
+        Coeffs = output;
+
+        minQ = (size_t)floor(samplefreq / maxFreq);
+        maxQ = (size_t)ceil(samplefreq / minFreq);
+        if (minQ < 2) minQ = 2;
+        if (maxQ > NumCoeffs - 2) maxQ = NumCoeffs - 2;
+
+        // the inverse FFT scaling differs between builds, measure it once
+        for (size_t i = 0; i < fftlength; i++) input[i] = 0;
+        input[0] = 1;
+        FFT->execute();
+        scale = (output[0] != 0) ? 1.0 / (output[0] * fftlength) : 1.0 / fftlength;
+    }
+
+    ~RealCepstrum()
+    {
+        delete FFT;
+        delete[] PeakValue;
+        delete[] PeakQuefrency;
+        delete[] output;
+        delete[] input;
+    }
+
+    //=======================================================================
+    /** calculate the cepstrum of a magnitude spectrum (fftlength / 2 bins)
+     * @returns Coeffs, the cepstrum for quefrency 0 .. fftlength/2 - 1 samples
+     */
+    float * calculate(const float *bins)
+    {
+        size_t half = fftlength / 2;
+
+        float peak = 0;
+        for (size_t k = 0; k < half; k++)
+            if (bins[k] > peak) peak = bins[k];
+        float logFloor = (peak > 0) ? peak * CEPSTRUM_FLOOR : FLT_MIN;
+
+        // the scaling of the inverse transform is folded into the log
+        input[0] = scale * fastLog(bins[0] + logFloor);
+        input[1] = scale * fastLog(bins[half - 1] + logFloor);      // Nyquist is not kept, use its neighbour
+        for (size_t k = 1; k < half; k++) {
+            input[2*k]     = scale * fastLog(bins[k] + logFloor);
+            input[2*k + 1] = 0;
+        }
+        FFT->execute();
+
+        findPeaks();
+        return Coeffs;
+    }
+
+    /** quefrency in samples to ms */
+    float quefrency(unsigned q)     { return q * 1000.0 / samplefreq; }
+
+    /** natural log of a positive normal float: exponent from the float bits, ln(1 + m) of
+     * the mantissa with a least squares polynomial, error < 2e-5 */
+    static inline float fastLog(float x)
+    {
+        union { float f; uint32_t i; } u = { x };
+        float e = (float)((int)((u.i >> 23) & 0xFF) - 127);
+        u.i = (u.i & 0x007FFFFF) | 0x3F800000;          // mantissa in [1, 2)
+        float m = u.f - 1;
+        float p = m * (0.9993970f + m * (-0.4912160f + m * (0.2879318f + m * (-0.1347412f + m * 0.0317952f))));
+        return e * 0.6931472f + p;
+    }
+
+    /** the cepstrum, NumCoeffs values */
+    float           *Coeffs;
+    size_t          NumCoeffs;
+    /** the highest peaks, quefrency in ms, sorted by value */
+    float           *PeakQuefrency;
+    float           *PeakValue;
+    size_t          NumPeaks = 0;
+
+private:
+    // local maxima in the quefrency range, keep the numPeaks highest
+    void findPeaks()
+    {
+        NumPeaks = 0;
+        for (size_t q = minQ; q <= maxQ; q++) {
+            float v = Coeffs[q];
+            if (v <= Coeffs[q - 1] || v < Coeffs[q + 1]) continue;
+            if (NumPeaks == numPeaks && v <= PeakValue[NumPeaks - 1]) continue;
+
+            size_t j = (NumPeaks < numPeaks) ? NumPeaks++ : NumPeaks - 1;
+            while (j > 0 && PeakValue[j - 1] < v) {
+                PeakValue[j] = PeakValue[j - 1];
+                PeakQuefrency[j] = PeakQuefrency[j - 1];
+                j--;
+            }
+            PeakValue[j] = v;
+            PeakQuefrency[j] = quefrency(q);
+        }
+    }
+
+    size_t          fftlength;
+    size_t          samplefreq;
+    size_t          numPeaks;
+    size_t          minQ;
+    size_t          maxQ;
+    float           scale;
+    float           *input;
+    float           *output;
+    ESP_fft         *FFT;
+};
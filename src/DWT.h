@@ -0,0 +1,176 @@
+//=======================================================================
+/** @file DWT.h
+ *  @brief In-place discrete wavelet transform (lifting scheme), Haar and Daubechies 4
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// The transform works in place and without any buffer: the coefficients are not
+// reordered but stay interleaved. After level l (1 = finest) the details of that level
+// are at odd multiples of 2^(l-1), the approximation at multiples of 2^l.
+// Boundaries are periodic, the length must be a multiple of 2^levels.
+//
+// Both wavelets are orthonormal, so the band energies add up to the signal energy.
+//
+
+class DWT
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param length_ the signal length
+     * @param levels_ number of decomposition levels
+     * @param type_ HaarWavelet or Daubechies4
+     */
+    DWT(size_t length_, size_t levels_, WaveletType type_ = Daubechies4) :
+            length(length_), levels(levels_), type(type_)
+    {
+        // never go below 2 approximation samples
+        while (levels > 0 && (length >> levels) < 2) levels--;
+    }
+
+    /** forward transform, in place */
+    void forward(float *x)
+    {
+        for (size_t l = 0; l < levels; l++) {
+            size_t stride = (size_t)1 << l;
+            size_t half = length >> (l + 1);
+            if (type == HaarWavelet)
+                haarForward(x, stride, half);
+            else
+                daub4Forward(x, stride, half);
+        }
+    }
+
+    /** inverse transform, in place */
+    void inverse(float *x)
+    {
+        for (long l = levels - 1; l >= 0; l--) {
+            size_t stride = (size_t)1 << l;
+            size_t half = length >> (l + 1);
+            if (type == HaarWavelet)
+                haarInverse(x, stride, half);
+            else
+                daub4Inverse(x, stride, half);
+        }
+    }
+
+    //=======================================================================
+    /** mean square per band, after forward()
+     * @param energies levels + 1 values: details of level 1 (highest band) .. levels, then the approximation
+     */
+    void bandEnergies(const float *x, float *energies)
+    {
+        for (size_t l = 0; l < levels; l++) {
+            size_t stride = (size_t)1 << l;
+            double sum = 0;
+            for (size_t i = stride; i < length; i += 2 * stride) sum += (double)x[i] * x[i];
+            energies[l] = sum / length;
+        }
+        size_t stride = (size_t)1 << levels;
+        double sum = 0;
+        for (size_t i = 0; i < length; i += stride) sum += (double)x[i] * x[i];
+        energies[levels] = sum / length;
+    }
+
+    size_t          length;
+    size_t          levels;
+    WaveletType     type;
+
+private:
+    // even samples at 2*i*stride, odd at (2*i+1)*stride
+    static inline float & even(float *x, size_t i, size_t stride) { return x[2 * i * stride]; }
+    static inline float & odd(float *x, size_t i, size_t stride)  { return x[(2 * i + 1) * stride]; }
+
+    void haarForward(float *x, size_t stride, size_t half)
+    {
+        for (size_t i = 0; i < half; i++) {
+            float &e = even(x, i, stride), &o = odd(x, i, stride);
+            float d = o - e;
+            float s = e + 0.5 * d;
+            e = s * (float)M_SQRT2;
+            o = d * (float)M_SQRT1_2;
+        }
+    }
+
+    void haarInverse(float *x, size_t stride, size_t half)
+    {
+        for (size_t i = 0; i < half; i++) {
+            float &e = even(x, i, stride), &o = odd(x, i, stride);
+            float s = e * (float)M_SQRT1_2;
+            float d = o * (float)M_SQRT2;
+            e = s - 0.5 * d;
+            o = d + e;
+        }
+    }
+
+    // Daubechies 4 factored in lifting steps (Daubechies & Sweldens)
+    void daub4Forward(float *x, size_t stride, size_t half)
+    {
+        const float s3 = 1.7320508f;
+        const float c1 = s3 / 4, c2 = (s3 - 2) / 4;
+        const float ns = (s3 - 1) / (float)M_SQRT2, nd = (s3 + 1) / (float)M_SQRT2;
+
+        for (size_t i = 0; i < half; i++)
+            even(x, i, stride) += s3 * odd(x, i, stride);
+
+        // periodic: s[-1] = s[half-1]
+        float last = even(x, half - 1, stride);
+        for (size_t i = 0; i < half; i++) {
+            float prev = (i > 0) ? even(x, i - 1, stride) : last;
+            odd(x, i, stride) -= c1 * even(x, i, stride) + c2 * prev;
+        }
+
+        float first = odd(x, 0, stride);
+        for (size_t i = 0; i < half; i++) {
+            float next = (i + 1 < half) ? odd(x, i + 1, stride) : first;
+            even(x, i, stride) -= next;
+        }
+
+        for (size_t i = 0; i < half; i++) {
+            even(x, i, stride) *= ns;
+            odd(x, i, stride) *= nd;
+        }
+    }
+
+    void daub4Inverse(float *x, size_t stride, size_t half)
+    {
+        const float s3 = 1.7320508f;
+        const float c1 = s3 / 4, c2 = (s3 - 2) / 4;
+        const float ns = (s3 - 1) / (float)M_SQRT2, nd = (s3 + 1) / (float)M_SQRT2;
+
+        for (size_t i = 0; i < half; i++) {
+            even(x, i, stride) /= ns;
+            odd(x, i, stride) /= nd;
+        }
+
+        float first = odd(x, 0, stride);
+        for (size_t i = 0; i < half; i++) {
+            float next = (i + 1 < half) ? odd(x, i + 1, stride) : first;
+            even(x, i, stride) += next;
+        }
+
+        float last = even(x, half - 1, stride);
+        for (size_t i = 0; i < half; i++) {
+            float prev = (i > 0) ? even(x, i - 1, stride) : last;
+            odd(x, i, stride) += c1 * even(x, i, stride) + c2 * prev;
+        }
+
+        for (size_t i = 0; i < half; i++)
+            even(x, i, stride) -= s3 * odd(x, i, stride);
+    }
+};
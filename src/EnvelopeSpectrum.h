@@ -0,0 +1,187 @@
+//=======================================================================
+/** @file EnvelopeSpectrum.h
+ *  @brief Hilbert envelope spectrum, for bearing and gear fault detection
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Band-pass, Hilbert transform and envelope are all done in the frequency domain:
+//  1. real FFT of the frame
+//  2. multiply the positive frequencies with a precomputed band mask (x2), drop the negative ones.
+//     That is the one-sided spectrum of the band-passed analytic signal
+//  3. inverse complex FFT gives the analytic signal, its magnitude is the envelope
+//  4. remove the mean of the envelope, window, real FFT -> envelope spectrum
+//
+// Two real FFTs and one complex one, i.e. about two complex FFTs per frame.
+// The forward transform and its buffers are shared by step 1 and 4.
+//
+
+#define ENVELOPE_TAPER_BINS     4       // cosine taper at both band edges
+
+class EnvelopeSpectrum
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param cfg analyzer config, fftlength and samplefreq are used
+     * @param lowFreq lower edge of the band of interest in Hz
+     * @param highFreq upper edge of the band of interest in Hz
+     */
+    EnvelopeSpectrum(const AnalyzerConfig &cfg, float lowFreq, float highFreq) :
+            fftlength(cfg.fftlength), samplefreq(cfg.samplefreq)
+    {
+        NumBins = fftlength / 2;
+        Fr = (float)samplefreq / fftlength;
+
+        signal   = new float[fftlength];
+        spectrum = new float[fftlength];
+        analytic = new float[2 * fftlength];
+        envelope = new float[2 * fftlength];
+        mask     = new float[NumBins];
+        window   = new float[fftlength];
+        Bins     = new float[NumBins];
+
+        forward = new ESP_fft(fftlength, samplefreq, FFT_REAL, FFT_FORWARD, signal, spectrum);
+        inverse = new ESP_fft(fftlength, samplefreq, FFT_COMPLEX, FFT_BACKWARD, analytic, envelope);
+
+        for (size_t i = 0; i < fftlength; i++)
+            window[i] = 0.54 - 0.46 * cos(2 * M_PI * i / (fftlength - 1));
+
+        // the scaling of the inverse transform differs between FFT builds, measure it once
+        for (size_t i = 0; i < 2 * fftlength; i++) analytic[i] = 0;
+        analytic[0] = 1;
+        inverse->execute();
+        inverseScale = (envelope[0] != 0) ? 1.0 / (envelope[0] * fftlength) : 1.0 / fftlength;
+
+        setBand(lowFreq, highFreq);
+    }
+
+    ~EnvelopeSpectrum()
+    {
+        delete inverse;
+        delete forward;
+        delete[] Bins;
+        delete[] window;
+        delete[] mask;
+        delete[] envelope;
+        delete[] analytic;
+        delete[] spectrum;
+        delete[] signal;
+    }
+
+    /** (re)compute the band mask, with a cosine taper at the edges. The band is clamped to
+     * bins 1 .. NumBins - 1
+     * @returns false for an empty band: highFreq below lowFreq, or outside the spectrum.
+     * The mask is then all zero
+     */
+    bool setBand(float lowFreq, float highFreq)
+    {
+        float top = NumBins - 1;
+        float flo = lowFreq / Fr, fhi = ceil(highFreq / Fr);
+        bool empty = !(highFreq >= lowFreq) || !(fhi >= 1) || !(flo <= top);
+
+        // clamp as floats, a cast of an out of range float to long is undefined
+        if (!(flo >= 1)) flo = 1;
+        if (flo > top) flo = top;
+        if (!(fhi <= top)) fhi = top;
+        if (fhi < flo) fhi = flo;
+        long lo = (long)flo;
+        long hi = (long)fhi;
+        firstBin = lo;
+        lastBin  = hi;
+
+        for (long k = 0; k < (long)NumBins; k++) {
+            float m = 0;
+            if (!empty && k >= lo && k <= hi) {
+                long edge = (k - lo < hi - k) ? k - lo : hi - k;
+                m = (edge >= ENVELOPE_TAPER_BINS) ? 1.0 : 0.5 - 0.5 * cos(M_PI * (edge + 0.5) / ENVELOPE_TAPER_BINS);
+            }
+            // x2 for the analytic signal, and the inverse scaling
+            mask[k] = 2 * m * inverseScale;
+        }
+        return !empty;
+    }
+
+    //=======================================================================
+    /** calculate the envelope spectrum of a frame of fftlength samples
+     * @returns Bins, the magnitude spectrum of the envelope
+     */
+    template <class S>
+    float * process(const S *Signal)
+    {
+        for (size_t i = 0; i < fftlength; i++) signal[i] = (float)Signal[i];
+        forward->execute();
+
+        // one-sided band spectrum, layout [DC, Nyquist, re1, im1 ...]
+        for (size_t i = 0; i < 2 * fftlength; i++) analytic[i] = 0;
+        for (size_t k = firstBin; k <= lastBin; k++) {
+            analytic[2*k]     = spectrum[2*k] * mask[k];
+            analytic[2*k + 1] = spectrum[2*k + 1] * mask[k];
+        }
+        inverse->execute();
+
+        double mean = 0;
+        for (size_t i = 0; i < fftlength; i++) {
+            float re = envelope[2*i], im = envelope[2*i + 1];
+            signal[i] = sqrt(re * re + im * im);
+            mean += signal[i];
+        }
+        mean /= fftlength;
+        Rms = 0;
+        for (size_t i = 0; i < fftlength; i++) {
+            float e = signal[i] - (float)mean;
+            Rms += e * e;
+            signal[i] = e * window[i];
+        }
+        Rms = sqrt(Rms / fftlength);
+        Mean = mean;
+
+        forward->execute();
+        forward->complexToMagnitude();
+        for (size_t k = 0; k < NumBins; k++) Bins[k] = spectrum[k];
+        Bins[0] = 0;
+
+        return Bins;
+    }
+
+    float frequency(unsigned bin)   { return bin * Fr; }
+    float amplitude(unsigned bin)   { return FFT_AMP_SCALE_FACTOR * fabs(Bins[bin]) / fftlength; }
+
+    /** the envelope spectrum, mean and rms (AC) of the envelope */
+    float           *Bins;
+    size_t          NumBins;
+    float           Fr;
+    float           Mean = 0;
+    float           Rms = 0;
+
+private:
+    size_t          fftlength;
+    size_t          samplefreq;
+    size_t          firstBin;
+    size_t          lastBin;
+    float           inverseScale;
+
+    float           *signal;
+    float           *spectrum;
+    float           *analytic;
+    float           *envelope;
+    float           *mask;
+    float           *window;
+
+    ESP_fft         *forward;
+    ESP_fft         *inverse;
+};
@@ -0,0 +1,407 @@
+//=======================================================================
+/** @file FeatureCodec.h
+ *  @brief Compact streaming codec for per-frame feature logs
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// A feature log is a sequence of rows (Features[], Mfccs, Signature ...), each row
+// has the same number of columns. Rows are collected in blocks. Within a block every column
+// is quantized with its own step, delta-coded against the previous row, zigzagged
+// and bit-packed with the smallest bit width that fits that column in that block.
+//
+// Stream layout:
+//   header  : "FLOG", version, numcolumns (u16), rowsperblock (u16), steps (float * numcolumns)
+//   blocks  : "FB", rows (u16), payload length (u32), payload
+//   payload : per column: first value (zigzag varint), bitwidth (u8), packed deltas
+//
+// Blocks are self-delimiting and all blocks except the last one are full, so a reader can
+// jump to any row by hopping over block headers, without decoding the data in between.
+//
+
+#define FEATURECODEC_MAGIC            "FLOG"
+#define FEATURECODEC_VERSION          1
+#define FEATURECODEC_BLOCKMAGIC       "FB"
+#define FEATURECODEC_HEADERLEN        10      // stream header, without the steps
+#define FEATURECODEC_BLOCKHEADERLEN   8
+#define FEATURECODEC_DEFAULT_BLOCKROWS 64
+#define FEATURECODEC_MAXQUANT         ((1L << 30) - 1)
+#define FEATURECODEC_MAX16            0xFFFF            // columns and rows per block are 16 bit
+
+//=======================================================================
+// shared helpers, little endian and LEB128 varints
+//
+class FeatureCodec
+{
+public:
+    static inline uint32_t zigzag(int32_t v)     { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+    static inline int32_t  unzigzag(uint32_t v)  { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+    static inline uint8_t * putVarint(uint8_t *p, uint32_t v)
+    {
+        while (v >= 0x80) { *p++ = (uint8_t)(v | 0x80); v >>= 7; }
+        *p++ = (uint8_t)v;
+        return p;
+    }
+
+    static inline const uint8_t * getVarint(const uint8_t *p, const uint8_t *end, uint32_t &v)
+    {
+        v = 0;
+        for (unsigned shift = 0; p < end && shift < 35; shift += 7) {
+            uint8_t b = *p++;
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return p;
+        }
+        return nullptr;
+    }
+
+    static inline void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+    static inline void put32(uint8_t *p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+    static inline uint16_t get16(const uint8_t *p)   { return p[0] | (p[1] << 8); }
+    static inline uint32_t get32(const uint8_t *p)   { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+    static inline unsigned bitWidth(uint32_t v)
+    {
+        unsigned b = 0;
+        while (v) { b++; v >>= 1; }
+        return b;
+    }
+
+    // worst case payload: varint + width byte + 32 bits per delta, per column
+    static size_t maxBlockLen(size_t numColumns, size_t rowsPerBlock)
+    {
+        return FEATURECODEC_BLOCKHEADERLEN + numColumns * (6 + 4 * rowsPerBlock);
+    }
+};
+
+//=======================================================================
+// Encoder. Collect rows with addRow(), when it returns true a complete block
+// is available in Block / BlockLen and can be written with writeBlock().
+// All memory is allocated in the constructor.
+//
+class FeatureEncoder
+{
+public:
+    FeatureEncoder(size_t numColumns_, const float *steps, size_t rowsPerBlock_ = FEATURECODEC_DEFAULT_BLOCKROWS) :
+            numColumns(numColumns_), rowsPerBlock(rowsPerBlock_)
+    {
+        if (rowsPerBlock > FEATURECODEC_MAX16) {
+            log_w("FeatureEncoder: %u rows per block, using %u", (unsigned)rowsPerBlock, FEATURECODEC_MAX16);
+            rowsPerBlock = FEATURECODEC_MAX16;
+        }
+        invSteps = new float[numColumns];
+        Steps    = new float[numColumns];
+        quant    = new int32_t[numColumns * rowsPerBlock];
+        Block    = new uint8_t[FeatureCodec::maxBlockLen(numColumns, rowsPerBlock)];
+
+        for (size_t c = 0; c < numColumns; c++) {
+            Steps[c]    = (steps != nullptr && steps[c] > 0) ? steps[c] : 1.0;
+            invSteps[c] = 1.0 / Steps[c];
+        }
+    }
+
+    ~FeatureEncoder()
+    {
+        delete[] Block;
+        delete[] quant;
+        delete[] Steps;
+        delete[] invSteps;
+    }
+
+    // Quantize and queue a row. Returns true when a block has been completed
+    bool addRow(const float *row)
+    {
+        int32_t *q = &quant[rows * numColumns];
+        for (size_t c = 0; c < numColumns; c++) q[c] = quantize(row[c] * invSteps[c]);
+        return queued();
+    }
+
+    // signatures are frequencies in Hz, use step 1 for an exact copy
+    bool addRow(const signature_t *row)
+    {
+        int32_t *q = &quant[rows * numColumns];
+        for (size_t c = 0; c < numColumns; c++) q[c] = quantize(row[c] * invSteps[c]);
+        return queued();
+    }
+
+    // Encode a partial block. Only at the end of a log, else row seeking breaks
+    bool flush()
+    {
+        if (rows == 0) return false;
+        encodeBlock();
+        return true;
+    }
+
+    // returns 0 if the header can't hold numColumns
+    size_t writeHeader(Print &out)
+    {
+        uint8_t hdr[FEATURECODEC_HEADERLEN];
+        memcpy(hdr, FEATURECODEC_MAGIC, 4);
+        put16(&hdr[4], FEATURECODEC_VERSION);
+        if (!put16(&hdr[6], numColumns) || !put16(&hdr[8], rowsPerBlock)) {
+            log_e("FeatureEncoder: %u columns do not fit the header", (unsigned)numColumns);
+            return 0;
+        }
+        size_t n = out.write(hdr, sizeof(hdr));
+        return n + out.write((const uint8_t *)Steps, numColumns * sizeof(float));
+    }
+
+    /** the value the decoder will return for v in column c: quantized, clamped, times the step */
+    float quantized(size_t c, float v) const  { return quantize(v * invSteps[c]) * Steps[c]; }
+
+    // write the last completed block, returns bytes written
+    size_t writeBlock(Print &out)
+    {
+        if (BlockLen == 0) return 0;
+        size_t n = out.write(Block, BlockLen);
+        BlockLen = 0;
+        return n;
+    }
+
+    size_t          numColumns;
+    size_t          rowsPerBlock;
+    float           *Steps;
+
+    /** the last encoded block and its size in bytes and rows */
+    uint8_t         *Block;
+    size_t          BlockLen = 0;
+    size_t          BlockRows = 0;
+
+private:
+    // refuses values that would be truncated
+    static inline bool put16(uint8_t *p, size_t v)
+    {
+        if (v > FEATURECODEC_MAX16) return false;
+        FeatureCodec::put16(p, v);
+        return true;
+    }
+
+    // NaN and overflow would wreck the delta coding, clamp them. The clamp is done on the
+    // integer: MAXQUANT rounds up to 2^30 as a float, so deltas could reach 2^31
+    static inline int32_t quantize(float v)
+    {
+        if (!(v == v)) return 0;
+        if (v >  2.0f * FEATURECODEC_MAXQUANT) return  FEATURECODEC_MAXQUANT;
+        if (v < -2.0f * FEATURECODEC_MAXQUANT) return -FEATURECODEC_MAXQUANT;
+        long q = lroundf(v);
+        if (q >  FEATURECODEC_MAXQUANT) q =  FEATURECODEC_MAXQUANT;
+        if (q < -FEATURECODEC_MAXQUANT) q = -FEATURECODEC_MAXQUANT;
+        return (int32_t)q;
+    }
+
+    bool queued()
+    {
+        if (++rows < rowsPerBlock) return false;
+        encodeBlock();
+        return true;
+    }
+
+    // column-major: all deltas of a column share one bitwidth
+    void encodeBlock()
+    {
+        uint8_t *p = Block + FEATURECODEC_BLOCKHEADERLEN;
+
+        for (size_t c = 0; c < numColumns; c++) {
+            const int32_t *q = &quant[c];
+            p = FeatureCodec::putVarint(p, FeatureCodec::zigzag(q[0]));
+
+            uint32_t maxz = 0;
+            for (size_t r = 1; r < rows; r++) {
+                uint32_t z = FeatureCodec::zigzag(q[r * numColumns] - q[(r-1) * numColumns]);
+                if (z > maxz) maxz = z;
+            }
+            unsigned width = FeatureCodec::bitWidth(maxz);
+            *p++ = (uint8_t) width;
+            if (width == 0) continue;
+
+            uint64_t acc = 0;
+            unsigned bits = 0;
+            for (size_t r = 1; r < rows; r++) {
+                uint32_t z = FeatureCodec::zigzag(q[r * numColumns] - q[(r-1) * numColumns]);
+                acc |= (uint64_t)z << bits;
+                bits += width;
+                while (bits >= 8) { *p++ = (uint8_t)acc; acc >>= 8; bits -= 8; }
+            }
+            if (bits) *p++ = (uint8_t)acc;
+        }
+
+        memcpy(Block, FEATURECODEC_BLOCKMAGIC, 2);
+        put16(&Block[2], rows);
+        FeatureCodec::put32(&Block[4], (uint32_t)(p - Block - FEATURECODEC_BLOCKHEADERLEN));
+
+        BlockLen = p - Block;
+        BlockRows = rows;
+        rows = 0;
+    }
+
+    float           *invSteps;
+    int32_t         *quant;
+    size_t          rows = 0;
+};
+
+//=======================================================================
+// Decoder. Works on a single block in memory, or on a log file with begin()
+// and readBlock() / seekRow() for random access.
+//
+class FeatureDecoder
+{
+public:
+    FeatureDecoder() {}
+
+    ~FeatureDecoder()
+    {
+        End();
+    }
+
+    // read the stream header and allocate the block buffer
+    bool begin(fs::File &f)
+    {
+        uint8_t hdr[FEATURECODEC_HEADERLEN];
+
+        End();
+        file = &f;
+        file->seek(0);
+        if (file->read(hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr, FEATURECODEC_MAGIC, 4) != 0 ||
+            FeatureCodec::get16(&hdr[4]) != FEATURECODEC_VERSION)
+        {
+            log_e("FeatureDecoder: not a feature log");
+            return false;
+        }
+        numColumns   = FeatureCodec::get16(&hdr[6]);
+        rowsPerBlock = FeatureCodec::get16(&hdr[8]);
+
+        Steps = new float[numColumns];
+        block = new uint8_t[FeatureCodec::maxBlockLen(numColumns, rowsPerBlock)];
+        if (file->read((uint8_t *)Steps, numColumns * sizeof(float)) != numColumns * sizeof(float)) return false;
+
+        firstBlock = curOffset = file->position();
+        curBlock = 0;
+        return true;
+    }
+
+    void End()
+    {
+        if (block) { delete[] block; block = nullptr; }
+        if (Steps) { delete[] Steps; Steps = nullptr; }
+        file = nullptr;
+    }
+
+    // decode the next block into rows (rowsPerBlock * numColumns floats), returns the number of rows
+    size_t readBlock(float *rows)
+    {
+        uint8_t hdr[FEATURECODEC_BLOCKHEADERLEN];
+
+        if (!file || !file->seek(curOffset)) return 0;
+        if (file->read(hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr, FEATURECODEC_BLOCKMAGIC, 2) != 0) return 0;
+
+        size_t len = FeatureCodec::get32(&hdr[4]);
+        if (len > FeatureCodec::maxBlockLen(numColumns, rowsPerBlock) - FEATURECODEC_BLOCKHEADERLEN) return 0;
+        memcpy(block, hdr, sizeof(hdr));
+        if (file->read(block + sizeof(hdr), len) != len) return 0;
+
+        curOffset += sizeof(hdr) + len;
+        curBlock++;
+        return decodeBlock(block, sizeof(hdr) + len, rows);
+    }
+
+    // position on a block, hopping over headers only. Forward seeks continue from the current block
+    bool seekBlock(size_t n)
+    {
+        uint8_t hdr[FEATURECODEC_BLOCKHEADERLEN];
+
+        if (!file) return false;
+        if (n < curBlock) { curBlock = 0; curOffset = firstBlock; }
+
+        while (curBlock < n) {
+            if (!file->seek(curOffset) || file->read(hdr, sizeof(hdr)) != sizeof(hdr) ||
+                memcmp(hdr, FEATURECODEC_BLOCKMAGIC, 2) != 0)
+                return false;
+            curOffset += sizeof(hdr) + FeatureCodec::get32(&hdr[4]);
+            curBlock++;
+        }
+        return true;
+    }
+
+    // seek to the block holding this row, returns the index of the row within that block
+    long seekRow(size_t row)
+    {
+        if (!rowsPerBlock || !seekBlock(row / rowsPerBlock)) return -1;
+        return row % rowsPerBlock;
+    }
+
+    // decode an encoded block in memory. steps must be set (begin(), or setSteps())
+    size_t decodeBlock(const uint8_t *blk, size_t len, float *rows)
+    {
+        if (len < FEATURECODEC_BLOCKHEADERLEN || memcmp(blk, FEATURECODEC_BLOCKMAGIC, 2) != 0) return 0;
+
+        size_t nrows = FeatureCodec::get16(&blk[2]);
+        if (nrows == 0 || nrows > rowsPerBlock) return 0;
+        const uint8_t *p   = blk + FEATURECODEC_BLOCKHEADERLEN;
+        const uint8_t *end = blk + len;
+
+        for (size_t c = 0; c < numColumns; c++) {
+            uint32_t z;
+            p = FeatureCodec::getVarint(p, end, z);
+            if (!p || p >= end) return 0;
+
+            int32_t  q = FeatureCodec::unzigzag(z);
+            unsigned width = *p++;
+            if (width > 32) return 0;           // damaged: the shifts below would overflow
+            float    step = Steps[c];
+            rows[c] = q * step;
+
+            uint64_t acc = 0;
+            unsigned bits = 0;
+            uint32_t mask = (width >= 32) ? 0xFFFFFFFF : ((1UL << width) - 1);
+            for (size_t r = 1; r < nrows; r++) {
+                if (width) {
+                    while (bits < width) {
+                        if (p >= end) return 0;
+                        acc |= (uint64_t)(*p++) << bits;
+                        bits += 8;
+                    }
+                    q += FeatureCodec::unzigzag((uint32_t)acc & mask);
+                    acc >>= width;
+                    bits -= width;
+                }
+                rows[r * numColumns + c] = q * step;
+            }
+        }
+        return nrows;
+    }
+
+    // for in-memory decoding without a file header
+    void setSteps(size_t numColumns_, size_t rowsPerBlock_, const float *steps)
+    {
+        End();
+        numColumns = numColumns_;
+        rowsPerBlock = rowsPerBlock_;
+        Steps = new float[numColumns];
+        for (size_t c = 0; c < numColumns; c++) Steps[c] = steps[c];
+    }
+
+    size_t          numColumns = 0;
+    size_t          rowsPerBlock = 0;
+    float           *Steps = nullptr;
+
+private:
+    fs::File        *file = nullptr;
+    uint8_t         *block = nullptr;
+    size_t          firstBlock = 0;
+    size_t          curOffset = 0;
+    size_t          curBlock = 0;
+};
@@ -0,0 +1,344 @@
+//=======================================================================
+/** @file FeatureStore.h
+ *  @brief Time indexed feature log with per block statistics, for range and threshold queries
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// A FeatureCodec log plus a sparse index, one store per sensor / stream:
+//   basePath.flog  the rows, with the time (ms, relative to the first row of the block) as column 0
+//   basePath.fidx  per block: first and last time, file offset, rows, min and max of every column
+//
+// The index has fixed size entries in time order, so a time range is found by binary
+// search on the file, without reading it into memory. Only the blocks that overlap the
+// range are decoded. A threshold search also skips the blocks whose min / max cannot match.
+// The statistics are of the quantized values (the encoder's own quantization, clamping
+// included), so they agree with what the decoder returns.
+//
+// Blocks can be flushed early (before deep sleep): the index holds the offset and the
+// number of rows of every block, so partial blocks are fine. After a reset halfway a block
+// write, the data without an index entry is simply never referenced, a torn index entry
+// is cut off (the index is rewritten through a temp file), so the times stay in order.
+// A store is only reopened with the columns, steps and block size it was created with.
+//
+
+#define FEATURESTORE_MAGIC          "FIDX"
+#define FEATURESTORE_HEADERLEN      8
+#define FEATURESTORE_ENTRYLEN(c)    (24 + 8 * (c))
+#define FEATURESTORE_MAXPATH        64
+
+// a row of a query: time in ms and numColumns values. Return false to stop the query
+typedef bool (*FeatureRowCallback)(uint64_t time, const float *row, void *arg);
+
+class FeatureStore
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param fs_ filesystem for the store
+     * @param basePath path without extension
+     * @param numColumns_ values per row
+     * @param steps quantization step per column, see FeatureEncoder
+     */
+    FeatureStore(fs::FS &fs_, const char *basePath, size_t numColumns_, const float *steps,
+                 size_t rowsPerBlock_ = FEATURECODEC_DEFAULT_BLOCKROWS) :
+            numColumns(numColumns_), rowsPerBlock(rowsPerBlock_), fs(fs_)
+    {
+        strncpy(path, basePath, FEATURESTORE_MAXPATH - 6);
+        path[FEATURESTORE_MAXPATH - 6] = 0;
+
+        // column 0 is the time in ms
+        float *s = new float[numColumns + 1];
+        s[0] = 1.0;
+        for (size_t c = 0; c < numColumns; c++) s[c + 1] = (steps != nullptr && steps[c] > 0) ? steps[c] : 1.0;
+        encoder = new FeatureEncoder(numColumns + 1, s, rowsPerBlock);
+        decoder.setSteps(numColumns + 1, rowsPerBlock, s);
+        delete[] s;
+
+        entryLen = FEATURESTORE_ENTRYLEN(numColumns);
+        entry  = new uint8_t[entryLen];
+        minima = new float[numColumns];
+        maxima = new float[numColumns];
+        row    = new float[numColumns + 1];
+        rows   = new float[rowsPerBlock * (numColumns + 1)];
+        block  = new uint8_t[FeatureCodec::maxBlockLen(numColumns + 1, rowsPerBlock)];
+    }
+
+    ~FeatureStore()
+    {
+        end();
+        delete[] block;
+        delete[] rows;
+        delete[] row;
+        delete[] maxima;
+        delete[] minima;
+        delete[] entry;
+        delete encoder;
+    }
+
+    // open or create both files
+    bool begin()
+    {
+        char name[FEATURESTORE_MAXPATH];
+        bool exists = fs.exists(filename(name, "flog"));
+        bool indexed = exists && fs.exists(filename(name, "fidx"));
+        if (exists && !checkLog()) return false;
+        if (indexed && !repairIndex()) return false;
+
+        data  = fs.open(filename(name, "flog"), exists ? FILE_APPEND : FILE_WRITE);
+        index = fs.open(filename(name, "fidx"), indexed ? FILE_APPEND : FILE_WRITE);
+        if (!data || !index) return false;
+
+        if (!exists && encoder->writeHeader(data) == 0) return false;
+        if (!indexed) {
+            uint8_t hdr[FEATURESTORE_HEADERLEN] = { 0 };
+            memcpy(hdr, FEATURESTORE_MAGIC, 4);
+            FeatureCodec::put16(&hdr[4], numColumns);
+            index.write(hdr, sizeof(hdr));
+        }
+        Blocks = (index.size() - FEATURESTORE_HEADERLEN) / entryLen;
+        blockRows = 0;
+        return true;
+    }
+
+    // write the open block and close
+    void end()
+    {
+        if (!data) return;
+        flush();
+        data.close();
+        index.close();
+    }
+
+    //=======================================================================
+    /** append a row, times must not decrease */
+    bool append(uint64_t time, const float *values)
+    {
+        if (!data) return false;
+
+        if (blockRows == 0) {
+            firstTime = time;
+            for (size_t c = 0; c < numColumns; c++) { minima[c] = INFINITY; maxima[c] = -INFINITY; }
+        }
+        lastTime = time;
+
+        row[0] = (float)(time - firstTime);
+        for (size_t c = 0; c < numColumns; c++) {
+            float q = encoder->quantized(c + 1, values[c]);
+            row[c + 1] = q;
+            if (q < minima[c]) minima[c] = q;
+            if (q > maxima[c]) maxima[c] = q;
+        }
+        blockRows++;
+        if (encoder->addRow(row)) return writeBlock();
+        return true;
+    }
+
+    /** write the open block now, e.g. before deep sleep */
+    bool flush()
+    {
+        if (!data || blockRows == 0) return true;
+        encoder->flush();
+        return writeBlock();
+    }
+
+    //=======================================================================
+    /** all rows with from <= time <= to
+     * @returns the number of rows passed to the callback
+     */
+    size_t query(uint64_t from, uint64_t to, FeatureRowCallback callback, void *arg = nullptr)
+    {
+        return search(-1, 0, 0, from, to, callback, arg);
+    }
+
+    /** rows in the time range with low <= value of column <= high. Blocks whose
+     * min / max do not overlap [low, high] are not read
+     */
+    size_t search(int column, float low, float high, uint64_t from, uint64_t to,
+                  FeatureRowCallback callback, void *arg = nullptr)
+    {
+        char name[FEATURESTORE_MAXPATH];
+        fs::File idx = fs.open(filename(name, "fidx"), FILE_READ);
+        fs::File dat = fs.open(filename(name, "flog"), FILE_READ);
+        if (!idx || !dat) return 0;
+
+        size_t count = 0;
+        bool more = true;
+        for (size_t b = firstBlock(idx, from); b < Blocks && more; b++) {
+            uint64_t first, last;
+            if (!readEntry(idx, b, first, last)) break;
+            if (first > to) break;
+            if (FeatureCodec::get16(&entry[20 + 8 * numColumns]) == 0) continue;
+
+            if (column >= 0) {
+                float mn = entryValue(16 + 8 * column), mx = entryValue(20 + 8 * column);
+                if (mx < low || mn > high) { Skipped++; continue; }
+            }
+
+            size_t n = readRows(dat, FeatureCodec::get32(&entry[16 + 8 * numColumns]));
+            for (size_t r = 0; r < n && more; r++) {
+                const float *v = &rows[r * (numColumns + 1)];
+                uint64_t t = first + (uint64_t)v[0];
+                if (t < from || t > to) continue;
+                if (column >= 0 && (v[column + 1] < low || v[column + 1] > high)) continue;
+                count++;
+                more = callback(t, &v[1], arg);
+            }
+        }
+        idx.close();
+        dat.close();
+        return count;
+    }
+
+    size_t          numColumns;
+    size_t          rowsPerBlock;
+    /** blocks in the index, blocks skipped by searches on the statistics */
+    size_t          Blocks = 0;
+    uint32_t        Skipped = 0;
+
+private:
+
+    char * filename(char *name, const char *ext)
+    {
+        snprintf(name, FEATURESTORE_MAXPATH, "%s.%s", path, ext);
+        return name;
+    }
+
+    // the header of an existing log must match this store, else the rows would decode wrong
+    bool checkLog()
+    {
+        char name[FEATURESTORE_MAXPATH];
+        fs::File f = fs.open(filename(name, "flog"), FILE_READ);
+        FeatureDecoder d;
+        bool ok = f && d.begin(f) && d.numColumns == numColumns + 1 && d.rowsPerBlock == encoder->rowsPerBlock &&
+                  memcmp(d.Steps, encoder->Steps, (numColumns + 1) * sizeof(float)) == 0;
+        d.End();
+        if (f) f.close();
+        if (!ok) log_e("FeatureStore: %s has other columns, steps or block size", name);
+        return ok;
+    }
+
+    // check the header of an existing index and cut off a torn last entry
+    bool repairIndex()
+    {
+        char name[FEATURESTORE_MAXPATH], tmp[FEATURESTORE_MAXPATH];
+        fs::File in = fs.open(filename(name, "fidx"), FILE_READ);
+        if (!in) return false;
+
+        uint8_t hdr[FEATURESTORE_HEADERLEN];
+        if (in.read(hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr, FEATURESTORE_MAGIC, 4) != 0 ||
+            FeatureCodec::get16(&hdr[4]) != numColumns) {
+            log_e("FeatureStore: %s is not an index of %u columns", name, (unsigned)numColumns);
+            in.close();
+            return false;
+        }
+        size_t entries = (in.size() - FEATURESTORE_HEADERLEN) / entryLen;
+        if (in.size() == FEATURESTORE_HEADERLEN + entries * entryLen) {
+            in.close();
+            return true;
+        }
+
+        fs::File out = fs.open(filename(tmp, "ftmp"), FILE_WRITE);
+        bool ok = out && out.write(hdr, sizeof(hdr)) == sizeof(hdr);
+        for (size_t e = 0; e < entries && ok; e++)
+            ok = in.read(entry, entryLen) == entryLen && out.write(entry, entryLen) == entryLen;
+        in.close();
+        if (out) out.close();
+        return ok && fs.remove(name) && fs.rename(tmp, name);
+    }
+
+    // entry: first time u64, last time u64, (min, max) float per column, offset u32, rows u16, pad
+    bool writeBlock()
+    {
+        uint32_t offset = data.size();
+        if (data.write(encoder->Block, encoder->BlockLen) != encoder->BlockLen) return false;
+        data.flush();
+
+        FeatureCodec::put32(&entry[0], (uint32_t)firstTime);
+        FeatureCodec::put32(&entry[4], (uint32_t)(firstTime >> 32));
+        FeatureCodec::put32(&entry[8], (uint32_t)lastTime);
+        FeatureCodec::put32(&entry[12], (uint32_t)(lastTime >> 32));
+        for (size_t c = 0; c < numColumns; c++) {
+            memcpy(&entry[16 + 8 * c], &minima[c], 4);
+            memcpy(&entry[20 + 8 * c], &maxima[c], 4);
+        }
+        FeatureCodec::put32(&entry[16 + 8 * numColumns], offset);
+        FeatureCodec::put16(&entry[20 + 8 * numColumns], blockRows);
+        FeatureCodec::put16(&entry[22 + 8 * numColumns], 0);
+
+        encoder->BlockLen = 0;
+        blockRows = 0;
+        if (index.write(entry, entryLen) != entryLen) return false;
+        index.flush();
+        Blocks++;
+        return true;
+    }
+
+    bool readEntry(fs::File &idx, size_t b, uint64_t &first, uint64_t &last)
+    {
+        if (!idx.seek(FEATURESTORE_HEADERLEN + b * entryLen) || idx.read(entry, entryLen) != entryLen) return false;
+        first = FeatureCodec::get32(&entry[0]) | (uint64_t)FeatureCodec::get32(&entry[4]) << 32;
+        last  = FeatureCodec::get32(&entry[8]) | (uint64_t)FeatureCodec::get32(&entry[12]) << 32;
+        return true;
+    }
+
+    inline float entryValue(size_t at)
+    {
+        float v;
+        memcpy(&v, &entry[at], 4);
+        return v;
+    }
+
+    // binary search: the first block whose last time is >= from
+    size_t firstBlock(fs::File &idx, uint64_t from)
+    {
+        size_t lo = 0, hi = Blocks;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            uint64_t first, last;
+            if (!readEntry(idx, mid, first, last)) return Blocks;
+            if (last < from) lo = mid + 1; else hi = mid;
+        }
+        return lo;
+    }
+
+    size_t readRows(fs::File &dat, uint32_t offset)
+    {
+        if (!dat.seek(offset) || dat.read(block, FEATURECODEC_BLOCKHEADERLEN) != FEATURECODEC_BLOCKHEADERLEN) return 0;
+        size_t len = FeatureCodec::get32(&block[4]);
+        if (len > FeatureCodec::maxBlockLen(numColumns + 1, rowsPerBlock) - FEATURECODEC_BLOCKHEADERLEN) return 0;
+        if (dat.read(block + FEATURECODEC_BLOCKHEADERLEN, len) != len) return 0;
+        return decoder.decodeBlock(block, FEATURECODEC_BLOCKHEADERLEN + len, rows);
+    }
+
+    fs::FS          &fs;
+    char            path[FEATURESTORE_MAXPATH];
+    fs::File        data;
+    fs::File        index;
+    FeatureEncoder  *encoder;
+    FeatureDecoder  decoder;
+    size_t          entryLen;
+    uint8_t         *entry;
+    uint8_t         *block;
+    float           *minima;
+    float           *maxima;
+    float           *row;
+    float           *rows;
+    size_t          blockRows = 0;
+    uint64_t        firstTime = 0;
+    uint64_t        lastTime = 0;
+};
@@ -0,0 +1,180 @@
+//=======================================================================
+/** @file FrameRing.h
+ *  @brief Zero copy frame transport between tasks / cores
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// A single producer / single consumer ring of fixed size frames, e.g. the sampler task on
+// one core and the analyzer task on the other. Frames are written and read in place:
+//
+//   producer:  T *slot = ring.acquire();  fill slot ...;  ring.commit();
+//   consumer:  const T *frame = ring.wait();  Processor.doFft(frame) ...;  ring.release();
+//
+// No locks and no queue copies. The indices are only written by their owner, the consumer
+// sleeps on a task notification that commit() gives, so a frame costs one notify.
+// A full ring never blocks the producer: acquire() returns nullptr and Dropped counts it.
+//
+// Slots and both indices are aligned to FRAME_RING_ALIGN, so the two cores never share a
+// cache line (PSRAM) and slots suit DMA. The same class carries results back, e.g. a
+// FrameRing<float> with rows of NumFeatures + NumMfccCoeff, filled with the getFeatures /
+// getMfcc overloads that write into a caller buffer.
+//
+// Every frame carries the time it arrived (micros() at commit, or the time of its last
+// sample if the producer passes it), so a consumer can trace the latency end to end.
+//
+
+#define FRAME_RING_ALIGN        32          // ESP32 cache line / DMA alignment
+
+template <class R>
+class FrameRing
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param slotLength_ elements of type R per frame
+     * @param numSlots_ frames in the ring, one less can be filled at a time
+     */
+    FrameRing(size_t slotLength_, size_t numSlots_) : SlotLength(slotLength_), NumSlots(numSlots_)
+    {
+        stride = (SlotLength * sizeof(R) + FRAME_RING_ALIGN - 1) & ~(size_t)(FRAME_RING_ALIGN - 1);
+        memory = new uint8_t[NumSlots * stride + FRAME_RING_ALIGN];
+        slots = (uint8_t *)(((uintptr_t)memory + FRAME_RING_ALIGN - 1) & ~(uintptr_t)(FRAME_RING_ALIGN - 1));
+
+        indices = new uint8_t[3 * FRAME_RING_ALIGN];
+        uint8_t *base = (uint8_t *)(((uintptr_t)indices + FRAME_RING_ALIGN - 1) & ~(uintptr_t)(FRAME_RING_ALIGN - 1));
+        head = (volatile size_t *)base;
+        tail = (volatile size_t *)(base + FRAME_RING_ALIGN);
+        *head = *tail = 0;
+        stamps = new uint32_t[NumSlots];
+    }
+
+    ~FrameRing()
+    {
+        delete[] stamps;
+        delete[] indices;
+        delete[] memory;
+    }
+
+    //=======================================================================
+    // producer side
+
+    /** the next free slot to fill, nullptr if the ring is full (the frame is dropped) */
+    R * acquire()
+    {
+        size_t h = *head;
+        if (next(h) == *tail) {
+            Dropped++;
+            return nullptr;
+        }
+        return slot(h);
+    }
+
+    /** no free slot, for a producer that would rather wait than drop */
+    bool full()                     { return next(*head) == *tail; }
+
+    /** publish the slot from acquire() and wake the consumer
+     * @param arrival time of the last sample in micros(), default now
+     */
+    void commit(uint32_t arrival)
+    {
+        publish(arrival);
+        TaskHandle_t c = consumer;
+        if (c) xTaskNotifyGive(c);
+    }
+    void commit()                   { commit(micros()); }
+
+    /** same, from an interrupt handler */
+    void IRAM_ATTR commitFromISR()
+    {
+        publish(micros());
+        TaskHandle_t c = consumer;
+        BaseType_t woken = pdFALSE;
+        if (c) vTaskNotifyGiveFromISR(c, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+
+    //=======================================================================
+    // consumer side
+
+    /** the oldest filled frame, waits for one at most timeout ticks
+     * @returns nullptr on timeout
+     */
+    const R * wait(TickType_t timeout = portMAX_DELAY)
+    {
+        // a commit between the check and the take leaves the notification pending, so none is lost
+        consumer = xTaskGetCurrentTaskHandle();
+        while (*tail == *head) {
+            if (ulTaskNotifyTake(pdTRUE, timeout) == 0 && *tail == *head) return nullptr;
+        }
+        __sync_synchronize();
+        return slot(*tail);
+    }
+
+    /** the oldest filled frame or nullptr, without waiting. For a task that serves several
+     * rings: it sleeps on its own notification, which every ring gives */
+    const R * peek()
+    {
+        consumer = xTaskGetCurrentTaskHandle();
+        if (*tail == *head) return nullptr;
+        __sync_synchronize();
+        return slot(*tail);
+    }
+
+    /** arrival time in micros() of the frame from wait() or peek() */
+    uint32_t arrival()              { return stamps[*tail]; }
+
+    /** the frame from wait() or peek() is processed, hand the slot back to the producer */
+    void release()
+    {
+        __sync_synchronize();
+        *tail = next(*tail);
+    }
+
+    /** number of filled frames */
+    size_t available()
+    {
+        size_t h = *head, t = *tail;
+        return (h >= t) ? h - t : h + NumSlots - t;
+    }
+
+    size_t          SlotLength;
+    size_t          NumSlots;
+    /** frames the producer could not place */
+    volatile uint32_t Dropped = 0;
+
+private:
+    inline size_t next(size_t i)    { return (i + 1 == NumSlots) ? 0 : i + 1; }
+    inline R * slot(size_t i)       { return (R *)(slots + i * stride); }
+
+    // the slot contents must be visible on the other core before the index
+    inline void publish(uint32_t arrival)
+    {
+        stamps[*head] = arrival;
+        __sync_synchronize();
+        *head = next(*head);
+    }
+
+    size_t          stride;
+    uint8_t         *memory;
+    uint8_t         *slots;
+    uint8_t         *indices;
+    volatile size_t *head;
+    volatile size_t *tail;
+    uint32_t        *stamps;
+    volatile TaskHandle_t consumer = nullptr;
+};
@@ -0,0 +1,262 @@
+//=======================================================================
+/** @file HPSS.h
+ *  @brief Streaming harmonic / percussive separation with running medians
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Median filtering HPSS (Fitzgerald 2010), frame by frame:
+//  - harmonic: per bin, the median over the last timeWindow frames (tonal = stable in time)
+//  - percussive: per frame, the median over freqWindow neighbouring bins (transient = flat in frequency)
+//  - soft (Wiener) masks H^2 / (H^2 + P^2) applied to the spectrum timeWindow/2 frames back,
+//    where the time median is centered. That is the fixed latency of the separation.
+//
+// The running medians use a pair of heaps per filter, a max-heap for the lower half and a
+// min-heap for the upper half, with the position of every window element tracked, so
+// replacing the oldest element costs O(log W). All filters share contiguous arrays.
+//
+// The separated spectra can be fed into Analyzer::getFeatures(Harmonic) etc for
+// per-component spectrum features.
+//
+
+#define HPSS_DEFAULT_TIME_WINDOW    17
+#define HPSS_DEFAULT_FREQ_WINDOW    17
+#define HPSS_MAX_WINDOW             255     // heap indices are bytes
+
+//=======================================================================
+// a bank of running medians with the same odd window length
+//
+class MedianBank
+{
+public:
+    MedianBank(size_t count_, size_t window_) : count(count_), window(window_ | 1)
+    {
+        if (window > HPSS_MAX_WINDOW) window = HPSS_MAX_WINDOW;
+        lower = (window + 1) / 2;
+
+        values = new float[count * window];
+        heap   = new uint8_t[count * window];
+        pos    = new uint8_t[count * window];
+        ring   = new uint8_t[count];
+        for (size_t f = 0; f < count; f++) reset(f);
+    }
+
+    ~MedianBank()
+    {
+        delete[] ring;
+        delete[] pos;
+        delete[] heap;
+        delete[] values;
+    }
+
+    // all zeros: any split into the two heaps is valid
+    void reset(size_t f)
+    {
+        size_t base = f * window;
+        for (size_t i = 0; i < window; i++) {
+            values[base + i] = 0;
+            heap[base + i] = i;
+            pos[base + i] = i;
+        }
+        ring[f] = 0;
+    }
+
+    /** replace the oldest value of filter f, returns the new median */
+    float update(size_t f, float v)
+    {
+        float   *val = &values[f * window];
+        uint8_t *hp  = &heap[f * window];
+        uint8_t *ps  = &pos[f * window];
+
+        size_t slot = ring[f];
+        ring[f] = (slot + 1 == window) ? 0 : slot + 1;
+        val[slot] = v;
+
+        size_t p = ps[slot];
+        if (p < lower) {
+            p = siftUp(val, hp, ps, 0, p, true);
+            siftDown(val, hp, ps, 0, lower, p, true);
+        } else {
+            p = siftUp(val, hp, ps, lower, p - lower, false);
+            siftDown(val, hp, ps, lower, window - lower, p, false);
+        }
+
+        // the max of the lower half must not exceed the min of the upper half
+        if (window > 1 && val[hp[0]] > val[hp[lower]]) {
+            uint8_t a = hp[0], b = hp[lower];
+            hp[0] = b;      ps[b] = 0;
+            hp[lower] = a;  ps[a] = lower;
+            siftDown(val, hp, ps, 0, lower, 0, true);
+            siftDown(val, hp, ps, lower, window - lower, 0, false);
+        }
+        return val[hp[0]];
+    }
+
+    float median(size_t f)  { return values[f * window + heap[f * window]]; }
+
+    size_t          count;
+    size_t          window;
+
+private:
+    // heap at hp[off .. off+n), max-heap or min-heap, i is the local index
+    static inline bool before(const float *val, uint8_t a, uint8_t b, bool isMax)
+    {
+        return isMax ? val[a] > val[b] : val[a] < val[b];
+    }
+
+    static inline void swap(uint8_t *hp, uint8_t *ps, size_t off, size_t i, size_t j)
+    {
+        uint8_t t = hp[off + i];
+        hp[off + i] = hp[off + j];
+        hp[off + j] = t;
+        ps[hp[off + i]] = off + i;
+        ps[hp[off + j]] = off + j;
+    }
+
+    static size_t siftUp(const float *val, uint8_t *hp, uint8_t *ps, size_t off, size_t i, bool isMax)
+    {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!before(val, hp[off + i], hp[off + parent], isMax)) break;
+            swap(hp, ps, off, i, parent);
+            i = parent;
+        }
+        return i;
+    }
+
+    static void siftDown(const float *val, uint8_t *hp, uint8_t *ps, size_t off, size_t n, size_t i, bool isMax)
+    {
+        for (;;) {
+            size_t best = i, l = 2 * i + 1, r = l + 1;
+            if (l < n && before(val, hp[off + l], hp[off + best], isMax)) best = l;
+            if (r < n && before(val, hp[off + r], hp[off + best], isMax)) best = r;
+            if (best == i) return;
+            swap(hp, ps, off, i, best);
+            i = best;
+        }
+    }
+
+    size_t          lower;
+    float           *values;
+    uint8_t         *heap;
+    uint8_t         *pos;
+    uint8_t         *ring;
+};
+
+//=======================================================================
+// harmonic / percussive separation of a stream of magnitude spectra
+//
+class HPSS
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param numBins_ bins per frame
+     * @param timeWindow frames in the harmonic median (odd)
+     * @param freqWindow bins in the percussive median (odd)
+     */
+    HPSS(size_t numBins_, size_t timeWindow = HPSS_DEFAULT_TIME_WINDOW, size_t freqWindow = HPSS_DEFAULT_FREQ_WINDOW) :
+            numBins(numBins_), timeMedian(numBins_, timeWindow), freqMedian(1, freqWindow)
+    {
+        Latency = timeMedian.window / 2;
+        depth = Latency + 1;
+
+        spectra    = new float[depth * numBins];
+        percussive = new float[depth * numBins];
+        Harmonic   = new float[numBins];
+        Percussive = new float[numBins];
+        reset();
+    }
+
+    ~HPSS()
+    {
+        delete[] Percussive;
+        delete[] Harmonic;
+        delete[] percussive;
+        delete[] spectra;
+    }
+
+    void reset()
+    {
+        for (size_t i = 0; i < depth * numBins; i++) spectra[i] = percussive[i] = 0;
+        for (size_t b = 0; b < numBins; b++) timeMedian.reset(b);
+        frames = 0;
+    }
+
+    //=======================================================================
+    /** add the magnitude spectrum of a frame
+     * @returns true when Harmonic / Percussive hold the frame of Latency frames ago
+     */
+    bool addFrame(const float *bins)
+    {
+        size_t slot = frames % depth;
+        float *spec = &spectra[slot * numBins];
+        float *perc = &percussive[slot * numBins];
+
+        // percussive median now, the frame is complete. Centered: output bin k after pushing k + half
+        size_t half = freqMedian.window / 2;
+        freqMedian.reset(0);
+        for (size_t k = 0; k < numBins + half; k++) {
+            float m = freqMedian.update(0, k < numBins ? bins[k] : 0);
+            if (k >= half) perc[k - half] = m;
+        }
+        for (size_t k = 0; k < numBins; k++) spec[k] = bins[k];
+
+        // the harmonic median is centered on the frame Latency back, which is the oldest in the ring
+        frames++;
+        size_t old = frames % depth;
+        const float *oldSpec = &spectra[old * numBins];
+        const float *oldPerc = &percussive[old * numBins];
+
+        double eh = 0, ep = 0;
+        for (size_t k = 0; k < numBins; k++) {
+            float h = timeMedian.update(k, bins[k]);
+            float p = oldPerc[k];
+            float h2 = h * h, p2 = p * p;
+            float mask = (h2 + p2 > 0) ? h2 / (h2 + p2) : 0.5;
+
+            Harmonic[k]   = oldSpec[k] * mask;
+            Percussive[k] = oldSpec[k] - Harmonic[k];
+            eh += (double)Harmonic[k] * Harmonic[k];
+            ep += (double)Percussive[k] * Percussive[k];
+        }
+        HarmonicEnergy = eh;
+        PercussiveEnergy = ep;
+        HarmonicRatio = (eh + ep > 0) ? eh / (eh + ep) : 0;
+
+        return frames > Latency;
+    }
+
+    /** separated spectra of the frame Latency frames back */
+    float           *Harmonic;
+    float           *Percussive;
+    /** energies of both components, and the harmonic part of the total */
+    float           HarmonicEnergy = 0;
+    float           PercussiveEnergy = 0;
+    float           HarmonicRatio = 0;
+    /** delay of the output in frames */
+    size_t          Latency;
+
+private:
+    size_t          numBins;
+    size_t          depth;
+    size_t          frames;
+    MedianBank      timeMedian;
+    MedianBank      freqMedian;
+    float           *spectra;
+    float           *percussive;
+};
@@ -0,0 +1,241 @@
+//=======================================================================
+/** @file LPC.h
+ *  @brief Linear prediction coefficients, LPC cepstra and formants
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+
+#define LPC_ROOT_ITERATIONS     60
+#define LPC_MIN_FORMANT_FREQ    90.0
+#define LPC_MAX_FORMANT_BW      400.0
+#define LPC_REAL_ROOT_EPS       1e-3        // |im| / |root| below this is a real root
+
+//=======================================================================
+// class for linear prediction analysis of a (windowed) frame
+//
+class LPC
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param order_ the prediction order, rule of thumb 2 + samplefreq / 1000
+     * @param samplingFrequency_ the sampling frequency, for the formants
+     * @param numCepstra_ the number of LPC cepstra, 0 = order + 1
+     */
+    LPC(size_t order_, size_t samplingFrequency_, size_t numCepstra_ = 0) :
+            order(order_), samplingFrequency(samplingFrequency_),
+            numCepstra(numCepstra_ ? numCepstra_ : order_ + 1)
+    {
+        autocorr    = new double[order + 1];
+        tmp         = new double[order + 1];
+        Coeffs      = new float[order + 1];
+        Reflection  = new float[order];
+        Cepstra     = new float[numCepstra];
+        rootRe      = new double[order];
+        rootIm      = new double[order];
+        Formants    = new float[(order + 1) / 2];
+        Bandwidths  = new float[(order + 1) / 2];
+    }
+
+    // cleanup, reverse order to prevent fragmentation
+    ~LPC()
+    {
+        delete[] Bandwidths;
+        delete[] Formants;
+        delete[] rootIm;
+        delete[] rootRe;
+        delete[] Cepstra;
+        delete[] Reflection;
+        delete[] Coeffs;
+        delete[] tmp;
+        delete[] autocorr;
+    }
+
+    //=======================================================================
+    /** Calculates the prediction coefficients of A(z) = 1 + a1 z^-1 + ... + ap z^-p,
+     * result in Coeffs (Coeffs[0] = 1), the reflection coefficients and the prediction Error.
+     * The lags are taken directly from the frame: for the usual orders (10..20) that is
+     * cheaper than an inverse FFT of the power spectrum, and has no circular aliasing.
+     * @param frame the windowed frame
+     * @param len the frame length
+     * @returns false if the frame is silent or the recursion is unstable
+     */
+    bool calculate(const float *frame, size_t len)
+    {
+        for (size_t k = 0; k <= order; k++) {
+            double sum = 0;
+            for (size_t n = k; n < len; n++)
+                sum += (double)frame[n] * frame[n - k];
+            autocorr[k] = sum;
+        }
+        // a tiny white noise floor (-60 dB) keeps the recursion stable on clean tones
+        autocorr[0] *= 1.0 + 1e-6;
+
+        if (!levinsonDurbin()) return false;
+        calculateCepstra();
+        return true;
+    }
+
+    //=======================================================================
+    /** Finds the formants from the roots of A(z), result in Formants / Bandwidths, sorted by frequency.
+     * At most order / 2, the lowest are kept
+     * @returns the number of formants found
+     */
+    size_t calculateFormants()
+    {
+        NumFormants = 0;
+        if (!findRoots()) return 0;
+
+        size_t maxFormants = order / 2;
+        for (size_t i = 0; i < order; i++) {
+            double mag = sqrt(rootRe[i] * rootRe[i] + rootIm[i] * rootIm[i]);
+            // one of each conjugate pair. Real roots come out of Durand-Kerner with a tiny imaginary part
+            if (rootIm[i] <= LPC_REAL_ROOT_EPS * mag) continue;
+
+            float freq = atan2(rootIm[i], rootRe[i]) * samplingFrequency / (2 * M_PI);
+            float bw   = -log(mag) * samplingFrequency / M_PI;
+            if (freq < LPC_MIN_FORMANT_FREQ || bw > LPC_MAX_FORMANT_BW) continue;
+            if (NumFormants == maxFormants) {
+                if (maxFormants == 0 || Formants[NumFormants - 1] <= freq) continue;
+                NumFormants--;                  // drop the highest
+            }
+
+            // insertion sort
+            size_t j = NumFormants++;
+            while (j > 0 && Formants[j - 1] > freq) {
+                Formants[j] = Formants[j - 1];
+                Bandwidths[j] = Bandwidths[j - 1];
+                j--;
+            }
+            Formants[j] = freq;
+            Bandwidths[j] = bw;
+        }
+        return NumFormants;
+    }
+
+    /** the prediction coefficients, order + 1 values, Coeffs[0] = 1 */
+    float       *Coeffs;
+    /** the reflection (PARCOR) coefficients, order values */
+    float       *Reflection;
+    /** the LPC cepstrum c0..c(numCepstra-1), c0 = ln(Error) */
+    float       *Cepstra;
+    /** formant frequencies and bandwidths in Hz, NumFormants valid */
+    float       *Formants;
+    float       *Bandwidths;
+    size_t      NumFormants = 0;
+    /** the residual prediction error */
+    float       Error = 0;
+
+    size_t      order;
+    size_t      samplingFrequency;
+    size_t      numCepstra;
+
+private:
+    bool levinsonDurbin()
+    {
+        double err = autocorr[0];
+        if (err <= 0) return false;
+
+        tmp[0] = 1;
+        for (size_t i = 1; i <= order; i++) tmp[i] = 0;
+
+        for (size_t i = 1; i <= order; i++) {
+            double acc = autocorr[i];
+            for (size_t j = 1; j < i; j++) acc += tmp[j] * autocorr[i - j];
+            double k = -acc / err;
+            Reflection[i - 1] = k;
+
+            // symmetric in-place update of a[1..i-1]
+            for (size_t j = 1; j <= i / 2; j++) {
+                double aj = tmp[j], aij = tmp[i - j];
+                tmp[j]     = aj + k * aij;
+                tmp[i - j] = aij + k * aj;
+            }
+            tmp[i] = k;
+
+            err *= (1 - k * k);
+            if (err <= 0) return false;
+        }
+
+        for (size_t i = 0; i <= order; i++) Coeffs[i] = tmp[i];
+        Error = err;
+        return true;
+    }
+
+    // recursion for the cepstrum of 1 / A(z)
+    void calculateCepstra()
+    {
+        Cepstra[0] = log(Error);
+        for (size_t n = 1; n < numCepstra; n++) {
+            double c = (n <= order) ? -tmp[n] : 0;
+            size_t kmin = (n > order) ? n - order : 1;
+            for (size_t k = kmin; k < n; k++)
+                c -= ((double)k / n) * Cepstra[k] * tmp[n - k];
+            Cepstra[n] = c;
+        }
+    }
+
+    // Durand-Kerner on z^p + a1 z^(p-1) + ... + ap, all roots at once
+    bool findRoots()
+    {
+        double re = 1, im = 0;
+        for (size_t i = 0; i < order; i++) {
+            rootRe[i] = re;
+            rootIm[i] = im;
+            // powers of 0.4 + 0.9i, the customary start values
+            double r = re * 0.4 - im * 0.9;
+            im = re * 0.9 + im * 0.4;
+            re = r;
+        }
+
+        for (int it = 0; it < LPC_ROOT_ITERATIONS; it++) {
+            double change = 0;
+            for (size_t i = 0; i < order; i++) {
+                // p(z) with Horner
+                double pr = 1, pi = 0;
+                for (size_t k = 1; k <= order; k++) {
+                    double t = pr * rootRe[i] - pi * rootIm[i] + tmp[k];
+                    pi = pr * rootIm[i] + pi * rootRe[i];
+                    pr = t;
+                }
+                // prod (z_i - z_j)
+                double qr = 1, qi = 0;
+                for (size_t j = 0; j < order; j++) {
+                    if (j == i) continue;
+                    double dr = rootRe[i] - rootRe[j], di = rootIm[i] - rootIm[j];
+                    double t = qr * dr - qi * di;
+                    qi = qr * di + qi * dr;
+                    qr = t;
+                }
+                double den = qr * qr + qi * qi;
+                if (den == 0) return false;
+                double cr = (pr * qr + pi * qi) / den;
+                double ci = (pi * qr - pr * qi) / den;
+                rootRe[i] -= cr;
+                rootIm[i] -= ci;
+                change += fabs(cr) + fabs(ci);
+            }
+            if (change < 1e-9) break;
+        }
+        return true;
+    }
+
+    double      *autocorr;
+    double      *tmp;
+    double      *rootRe;
+    double      *rootIm;
+};
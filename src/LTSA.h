@@ -0,0 +1,260 @@
+//=======================================================================
+/** @file LTSA.h
+ *  @brief Long-term spectral average, stored as a multi-level pyramid
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Bins of consecutive frames are averaged over an interval of framesPerInterval frames,
+// giving one level 0 row. Every 'fanout' rows of a level are averaged again into one row
+// of the next level, like the mipmaps of a texture. Each level is a separate file with
+// raw float rows of numBins, so row r of level L is at offset r * numBins * 4 and covers
+// level 0 rows [r * fanout^L, (r+1) * fanout^L).
+//
+// To render a time range, pick the level with bestLevel() and read only those rows.
+// After a restart begin() rebuilds the partial averages from the files, so the
+// levels stay aligned. A row torn by a reset halfway a write is cut off first, else
+// every later row would sit at the wrong offset.
+//
+
+#define LTSA_DEFAULT_FANOUT     4
+#define LTSA_MAXPATH            64
+
+class LTSA
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param numBins the number of bins per frame (Analyzer NumBins)
+     * @param framesPerInterval number of frames averaged in a level 0 row
+     * @param numLevels number of pyramid levels
+     * @param fs filesystem to store the levels on
+     * @param basePath path prefix, level files are basePath.L0, basePath.L1 ...
+     */
+    LTSA(size_t numBins_, size_t framesPerInterval_, size_t numLevels_, fs::FS &fs_, const char *basePath,
+         size_t fanout_ = LTSA_DEFAULT_FANOUT) :
+            numBins(numBins_), framesPerInterval(framesPerInterval_), numLevels(numLevels_), fanout(fanout_), fs(fs_)
+    {
+        strncpy(path, basePath, LTSA_MAXPATH - 4);
+        path[LTSA_MAXPATH - 4] = 0;
+
+        accum  = new double*[numLevels];
+        counts = new size_t[numLevels];
+        Rows   = new size_t[numLevels];
+        files  = new fs::File[numLevels];
+        row    = new float[numBins];
+        for (size_t l = 0; l < numLevels; l++) {
+            accum[l] = new double[numBins];
+            counts[l] = 0;
+            Rows[l] = 0;
+        }
+    }
+
+    ~LTSA()
+    {
+        end();
+        delete[] row;
+        delete[] files;
+        delete[] Rows;
+        delete[] counts;
+        for (long l = numLevels - 1; l >= 0; l--)
+            delete[] accum[l];
+        delete[] accum;
+    }
+
+    // open the level files and restore the partial upper level averages
+    bool begin()
+    {
+        char name[LTSA_MAXPATH];
+        size_t rowBytes = numBins * sizeof(float);
+
+        for (size_t l = 0; l < numLevels; l++) {
+            levelName(name, l);
+            if (!dropTornRow(name, rowBytes)) {
+                log_e("LTSA: can't repair %s", name);
+                return false;
+            }
+            files[l] = fs.open(name, FILE_APPEND);
+            if (!files[l]) {
+                log_e("LTSA: can't open %s", name);
+                return false;
+            }
+            Rows[l] = files[l].size() / rowBytes;
+            clear(l);
+        }
+
+        // rows of the lower level that have not yet been folded into the next one. A reset
+        // between writing a row and its cascade leaves a complete group: write its row now.
+        // Bottom up and without cascading, the next level reads it back from the file
+        for (size_t l = 1; l < numLevels; l++) {
+            size_t done = Rows[l] * fanout;
+            for (size_t r = done; r < Rows[l-1]; r++) {
+                if (readRows(l-1, r, 1, row) != 1) break;
+                for (size_t b = 0; b < numBins; b++) accum[l][b] += row[b];
+                if (++counts[l] >= fanout && !writeRow(l)) return false;
+            }
+        }
+        return true;
+    }
+
+    void end()
+    {
+        for (size_t l = 0; l < numLevels; l++)
+            if (files[l]) files[l].close();
+    }
+
+    //=======================================================================
+    /** Add the magnitude spectrum of one frame
+     * @returns true when a level 0 row was completed and written
+     */
+    bool addFrame(const float *bins)
+    {
+        double *acc = accum[0];
+        for (size_t b = 0; b < numBins; b++) acc[b] += bins[b];
+
+        if (++counts[0] < framesPerInterval) return false;
+        return emit(0);
+    }
+
+    //=======================================================================
+    /** Read rows of a level
+     * @param out rows * numBins floats
+     * @returns the number of rows read
+     */
+    size_t readRows(size_t level, size_t first, size_t count, float *out)
+    {
+        char name[LTSA_MAXPATH];
+
+        if (level >= numLevels || first >= Rows[level]) return 0;
+        if (first + count > Rows[level]) count = Rows[level] - first;
+
+        if (files[level]) files[level].flush();
+        levelName(name, level);
+        fs::File f = fs.open(name, FILE_READ);
+        if (!f) return 0;
+
+        size_t rowBytes = numBins * sizeof(float);
+        size_t n = 0;
+        if (f.seek(first * rowBytes))
+            n = f.read((uint8_t *)out, count * rowBytes) / rowBytes;
+        f.close();
+        return n;
+    }
+
+    /** the coarsest level that still gives at least minRows rows for a range of level 0 rows */
+    size_t bestLevel(size_t first, size_t last, size_t minRows)
+    {
+        size_t span = (last > first) ? last - first : 1;
+        size_t level = 0;
+        while (level + 1 < numLevels && span / fanout >= minRows) {
+            span /= fanout;
+            level++;
+        }
+        return level;
+    }
+
+    /** number of level 0 rows covered by one row of a level */
+    size_t rowSpan(size_t level)
+    {
+        size_t s = 1;
+        while (level--) s *= fanout;
+        return s;
+    }
+
+    size_t          numBins;
+    size_t          framesPerInterval;
+    size_t          numLevels;
+    size_t          fanout;
+
+    /** the number of rows stored per level */
+    size_t          *Rows;
+
+private:
+    void levelName(char *name, size_t level)
+    {
+        snprintf(name, LTSA_MAXPATH, "%s.L%u", path, (unsigned)level);
+    }
+
+    // copy the whole rows to a temp file and replace the level with it
+    bool dropTornRow(const char *name, size_t rowBytes)
+    {
+        if (!fs.exists(name)) return true;
+        fs::File in = fs.open(name, FILE_READ);
+        if (!in) return false;
+        size_t rows = in.size() / rowBytes;
+        if (in.size() == rows * rowBytes) {
+            in.close();
+            return true;
+        }
+
+        char tmp[LTSA_MAXPATH + 4];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+        fs::File out = fs.open(tmp, FILE_WRITE);
+        bool ok = out;
+        for (size_t r = 0; r < rows && ok; r++)
+            ok = in.read((uint8_t *)row, rowBytes) == rowBytes && out.write((const uint8_t *)row, rowBytes) == rowBytes;
+        in.close();
+        if (out) out.close();
+        if (!ok) return false;
+        log_w("LTSA: dropped a torn row of %s", name);
+        return fs.remove(name) && fs.rename(tmp, name);
+    }
+
+    void clear(size_t level)
+    {
+        for (size_t b = 0; b < numBins; b++) accum[level][b] = 0;
+        counts[level] = 0;
+    }
+
+    // write the average of a level into row. A row that could not be written is not
+    // counted, so the levels stay aligned (the interval is lost on all of them)
+    bool writeRow(size_t level)
+    {
+        double *acc = accum[level];
+        double  inv = 1.0 / counts[level];
+        size_t  rowBytes = numBins * sizeof(float);
+
+        for (size_t b = 0; b < numBins; b++) row[b] = (float)(acc[b] * inv);
+        clear(level);
+        if (files[level].write((const uint8_t *)row, rowBytes) != rowBytes) {
+            log_e("LTSA: write failed on level %u", (unsigned)level);
+            return false;
+        }
+        Rows[level]++;
+        return true;
+    }
+
+    // write the average of a level and fold it into the next one
+    bool emit(size_t level)
+    {
+        if (!writeRow(level)) return false;
+
+        if (level + 1 < numLevels) {
+            double *up = accum[level + 1];
+            for (size_t b = 0; b < numBins; b++) up[b] += row[b];
+            if (++counts[level + 1] >= fanout) emit(level + 1);
+        }
+        return true;
+    }
+
+    fs::FS          &fs;
+    char            path[LTSA_MAXPATH];
+    fs::File        *files;
+    double          **accum;
+    size_t          *counts;
+    float           *row;
+};
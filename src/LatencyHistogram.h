@@ -0,0 +1,104 @@
+//=======================================================================
+/** @file LatencyHistogram.h
+ *  @brief Fixed size log histogram of latencies in microseconds, with percentiles
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Every octave of microseconds is split in LATENCY_SUBBUCKETS buckets, so a percentile is
+// within 25% at any scale, from 1 us to half a minute, in 96 counters. Recording is a
+// count leading zeros and an increment, cheap enough for every frame.
+//
+// Percentiles return the upper edge of their bucket (never below the real value), capped
+// at the largest latency seen; the last bucket is open ended. Histograms of several
+// streams or runs can be merged.
+//
+
+#define LATENCY_SUBBUCKETS      4           // the 2 bits below the top bit
+#define LATENCY_OCTAVES         24
+#define LATENCY_BUCKETS         (LATENCY_SUBBUCKETS * LATENCY_OCTAVES)
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()      { reset(); }
+
+    void reset()
+    {
+        memset(counts, 0, sizeof(counts));
+        Count = 0;
+        Total = 0;
+        Max = 0;
+    }
+
+    /** add a latency in us */
+    void record(uint32_t us)
+    {
+        counts[bucket(us)]++;
+        Count++;
+        Total += us;
+        if (us > Max) Max = us;
+    }
+
+    void merge(const LatencyHistogram & other)
+    {
+        for (size_t b = 0; b < LATENCY_BUCKETS; b++) counts[b] += other.counts[b];
+        Count += other.Count;
+        Total += other.Total;
+        if (other.Max > Max) Max = other.Max;
+    }
+
+    /** latency in us that a fraction p (0 .. 1) of the records does not exceed */
+    uint32_t percentile(float p) const
+    {
+        if (Count == 0) return 0;
+        uint32_t target = (p >= 1) ? Count : (uint32_t)(p * Count) + 1, sum = 0;
+        for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+            sum += counts[b];
+            if (sum >= target) return (b < LATENCY_BUCKETS - 1 && upper(b) < Max) ? upper(b) : Max;
+        }
+        return Max;
+    }
+
+    uint32_t mean() const   { return Count ? Total / Count : 0; }
+
+    uint32_t        Count;
+    uint64_t        Total;
+    uint32_t        Max;
+
+private:
+    // below LATENCY_SUBBUCKETS one bucket per us, above that the top 3 bits select the bucket
+    static inline size_t bucket(uint32_t us)
+    {
+        if (us < LATENCY_SUBBUCKETS) return us;
+        size_t octave = 31 - __builtin_clz(us);
+        size_t b = (octave - 1) * LATENCY_SUBBUCKETS + ((us >> (octave - 2)) & (LATENCY_SUBBUCKETS - 1));
+        return (b < LATENCY_BUCKETS) ? b : LATENCY_BUCKETS - 1;
+    }
+
+    // largest latency that falls in bucket b
+    static inline uint32_t upper(size_t b)
+    {
+        if (b < LATENCY_SUBBUCKETS) return b;
+        size_t octave = b / LATENCY_SUBBUCKETS + 1;
+        uint64_t low = (uint64_t)(LATENCY_SUBBUCKETS + b % LATENCY_SUBBUCKETS) << (octave - 2);
+        uint64_t high = low + ((uint64_t)1 << (octave - 2)) - 1;
+        return (high > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)high;
+    }
+
+    uint32_t        counts[LATENCY_BUCKETS];
+};
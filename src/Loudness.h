@@ -0,0 +1,304 @@
+//=======================================================================
+/** @file Loudness.h
+ *  @brief ITU-R BS.1770 / EBU R128 loudness: LUFS, loudness range and true peak
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Streaming mono loudness meter:
+//  - K-weighting: high shelf + high pass biquads, coefficients computed for any samplefreq
+//  - mean square per 100 ms block, kept in a ring of 30 blocks (3 s)
+//  - momentary = last 4 blocks (400 ms), short-term = last 30 blocks (3 s)
+//  - every 100 ms the momentary and short-term energies are added to a histogram of
+//    0.1 LU bins, so integrated loudness and loudness range are gated from the histogram
+//    in a fixed number of steps, without keeping or re-scanning the history
+//  - true peak with a 4x polyphase oversampler (48 taps, 12 per phase)
+//
+// Loudness is relative to fullScale, e.g. 32768 for int16 samples or the
+// mV range of the ADC for ESP32Sampler data.
+//
+
+#define LOUDNESS_SILENCE        -200.0      // returned when nothing has been measured
+#define LOUDNESS_HIST_MIN       -70.0       // absolute gate, also the lower end of the histogram
+#define LOUDNESS_HIST_MAX       10.0
+#define LOUDNESS_HIST_STEP      0.1
+#define LOUDNESS_HIST_BINS      800         // (MAX - MIN) / STEP
+#define LOUDNESS_BLOCKS         30          // 3 s of 100 ms blocks
+#define LOUDNESS_TP_PHASES      4
+#define LOUDNESS_TP_TAPS        12          // taps per phase
+
+class LoudnessMeter
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param samplefreq the sampling frequency
+     * @param fullScale the sample value of digital full scale
+     * @param truePeak_ false to skip the oversampler
+     */
+    LoudnessMeter(size_t samplefreq_, float fullScale_ = 1.0, bool truePeak_ = true) :
+            samplefreq(samplefreq_), truePeakOn(truePeak_)
+    {
+        invFullScale = 1.0 / fullScale_;
+        blockLen = samplefreq / 10;
+
+        // stage 1, high shelf (+4 dB above 1.5 kHz)
+        double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+        double K  = tan(M_PI * f0 / samplefreq);
+        double Vh = pow(10.0, G / 20.0);
+        double Vb = pow(Vh, 0.4996667741545416);
+        double a0 = 1.0 + K / Q + K * K;
+        shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+        shelf.b1 = 2.0 * (K * K - Vh) / a0;
+        shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+        shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+        shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+        // stage 2, RLB high pass at 38 Hz
+        f0 = 38.13547087602444; Q = 0.5003270373238773;
+        K  = tan(M_PI * f0 / samplefreq);
+        a0 = 1.0 + K / Q + K * K;
+        highpass.b0 = 1.0;
+        highpass.b1 = -2.0;
+        highpass.b2 = 1.0;
+        highpass.a1 = 2.0 * (K * K - 1.0) / a0;
+        highpass.a2 = (1.0 - K / Q + K * K) / a0;
+
+        // energy at the center of every histogram bin
+        histEnergy = new double[LOUDNESS_HIST_BINS];
+        momentaryHist = new uint32_t[LOUDNESS_HIST_BINS];
+        shortTermHist = new uint32_t[LOUDNESS_HIST_BINS];
+        for (size_t i = 0; i < LOUDNESS_HIST_BINS; i++)
+            histEnergy[i] = toEnergy(LOUDNESS_HIST_MIN + (i + 0.5) * LOUDNESS_HIST_STEP);
+
+        // 4x interpolator: Blackman windowed sinc at the original Nyquist frequency, gain 4
+        const size_t taps = LOUDNESS_TP_PHASES * LOUDNESS_TP_TAPS;
+        polyphase = new float[taps];
+        for (size_t i = 0; i < taps; i++) {
+            double n = (double)i - (taps - 1) / 2.0;
+            double x = M_PI * n / LOUDNESS_TP_PHASES;
+            double s = (n == 0) ? 1.0 : sin(x) / x;
+            double w = 0.42 - 0.5 * cos(2 * M_PI * i / (taps - 1)) + 0.08 * cos(4 * M_PI * i / (taps - 1));
+            // stored per phase: polyphase[p * TAPS + k] = h[k * PHASES + p]
+            polyphase[(i % LOUDNESS_TP_PHASES) * LOUDNESS_TP_TAPS + i / LOUDNESS_TP_PHASES] = s * w;
+        }
+        reset();
+    }
+
+    ~LoudnessMeter()
+    {
+        delete[] polyphase;
+        delete[] shortTermHist;
+        delete[] momentaryHist;
+        delete[] histEnergy;
+    }
+
+    void reset()
+    {
+        shelf.z1 = shelf.z2 = highpass.z1 = highpass.z2 = 0;
+        for (size_t i = 0; i < LOUDNESS_BLOCKS; i++) blocks[i] = 0;
+        for (size_t i = 0; i < LOUDNESS_HIST_BINS; i++) momentaryHist[i] = shortTermHist[i] = 0;
+        for (size_t i = 0; i < 2 * LOUDNESS_TP_TAPS; i++) tpHistory[i] = 0;
+        numBlocks = 0;
+        blockPos = 0;
+        blockSum = 0;
+        blockFill = 0;
+        tpPos = 0;
+        peak = 0;
+        blockPeak = 0;
+        BlockPeak = 0;
+    }
+
+    //=======================================================================
+    /** feed samples, any length */
+    template <class S>
+    void process(const S *samples, size_t len)
+    {
+        for (size_t i = 0; i < len; i++) {
+            float x = (float)samples[i] * invFullScale;
+
+            if (truePeakOn) truePeakSample(x);
+
+            double y = highpass.filter(shelf.filter(x));
+            blockSum += y * y;
+
+            if (++blockFill == blockLen) endBlock();
+        }
+    }
+
+    //=======================================================================
+    /** loudness values in LUFS */
+    float momentary()   { return numBlocks >= 4 ? toLoudness(windowEnergy(4)) : LOUDNESS_SILENCE; }
+    float shortTerm()   { return numBlocks >= LOUDNESS_BLOCKS ? toLoudness(windowEnergy(LOUDNESS_BLOCKS)) : LOUDNESS_SILENCE; }
+
+    /** gated integrated loudness: absolute gate -70 LUFS, relative gate -10 LU */
+    float integrated()
+    {
+        double sum = 0;
+        uint32_t count = 0;
+        for (size_t i = 0; i < LOUDNESS_HIST_BINS; i++) {
+            sum += momentaryHist[i] * histEnergy[i];
+            count += momentaryHist[i];
+        }
+        if (count == 0) return LOUDNESS_SILENCE;
+
+        size_t gate = histIndex(toLoudness(sum / count) - 10.0);
+        sum = 0;
+        count = 0;
+        for (size_t i = gate; i < LOUDNESS_HIST_BINS; i++) {
+            sum += momentaryHist[i] * histEnergy[i];
+            count += momentaryHist[i];
+        }
+        return count ? toLoudness(sum / count) : LOUDNESS_SILENCE;
+    }
+
+    /** loudness range (EBU 3342) in LU: 10th to 95th percentile of gated short-term loudness */
+    float loudnessRange()
+    {
+        double sum = 0;
+        uint32_t count = 0;
+        for (size_t i = 0; i < LOUDNESS_HIST_BINS; i++) {
+            sum += shortTermHist[i] * histEnergy[i];
+            count += shortTermHist[i];
+        }
+        if (count == 0) return 0;
+
+        size_t gate = histIndex(toLoudness(sum / count) - 20.0);
+        count = 0;
+        for (size_t i = gate; i < LOUDNESS_HIST_BINS; i++) count += shortTermHist[i];
+        if (count == 0) return 0;
+
+        uint32_t lowRank  = (uint32_t)(0.10 * (count - 1));
+        uint32_t highRank = (uint32_t)(0.95 * (count - 1));
+        float low = 0, high = 0;
+        uint32_t seen = 0;
+        bool lowFound = false;
+        for (size_t i = gate; i < LOUDNESS_HIST_BINS; i++) {
+            seen += shortTermHist[i];
+            if (!lowFound && seen > lowRank) { low = histLoudness(i); lowFound = true; }
+            if (seen > highRank) { high = histLoudness(i); break; }
+        }
+        return high - low;
+    }
+
+    /** maximum true peak since reset, in dBTP */
+    float truePeak()    { return peak > 0 ? 20.0 * log10(peak) : LOUDNESS_SILENCE; }
+
+    /** true peak (linear, full scale = 1) of the last 100 ms block */
+    float           BlockPeak;
+
+private:
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+        double z1, z2;
+
+        // transposed direct form II
+        inline double filter(double x)
+        {
+            double y = b0 * x + z1;
+            z1 = b1 * x - a1 * y + z2;
+            z2 = b2 * x - a2 * y;
+            return y;
+        }
+    };
+
+    static double toEnergy(double lufs)  { return pow(10.0, (lufs + 0.691) / 10.0); }
+    static float toLoudness(double e)    { return e > 0 ? (float)(-0.691 + 10.0 * log10(e)) : LOUDNESS_SILENCE; }
+    static float histLoudness(size_t i)  { return LOUDNESS_HIST_MIN + (i + 0.5) * LOUDNESS_HIST_STEP; }
+
+    static size_t histIndex(float lufs)
+    {
+        if (lufs <= LOUDNESS_HIST_MIN) return 0;
+        size_t i = (size_t)((lufs - LOUDNESS_HIST_MIN) / LOUDNESS_HIST_STEP);
+        return i < LOUDNESS_HIST_BINS ? i : LOUDNESS_HIST_BINS - 1;
+    }
+
+    double windowEnergy(size_t n)
+    {
+        double sum = 0;
+        size_t pos = blockPos;
+        for (size_t i = 0; i < n; i++) {
+            pos = (pos == 0) ? LOUDNESS_BLOCKS - 1 : pos - 1;
+            sum += blocks[pos];
+        }
+        return sum / n;
+    }
+
+    void addToHistogram(uint32_t *hist, double energy)
+    {
+        float l = toLoudness(energy);
+        if (l >= LOUDNESS_HIST_MIN) hist[histIndex(l)]++;
+    }
+
+    // a 100 ms block is complete: 75% overlapped gating blocks come for free
+    void endBlock()
+    {
+        blocks[blockPos] = blockSum / blockLen;
+        if (++blockPos == LOUDNESS_BLOCKS) blockPos = 0;
+        if (numBlocks < LOUDNESS_BLOCKS) numBlocks++;
+
+        if (numBlocks >= 4) addToHistogram(momentaryHist, windowEnergy(4));
+        if (numBlocks >= LOUDNESS_BLOCKS) addToHistogram(shortTermHist, windowEnergy(LOUDNESS_BLOCKS));
+
+        blockSum = 0;
+        blockFill = 0;
+        BlockPeak = blockPeak;
+        blockPeak = 0;
+    }
+
+    inline void truePeakSample(float x)
+    {
+        tpHistory[tpPos] = tpHistory[tpPos + LOUDNESS_TP_TAPS] = x;
+        if (++tpPos == LOUDNESS_TP_TAPS) tpPos = 0;
+
+        // newest sample last in the window
+        const float *h = &tpHistory[tpPos];
+        for (size_t p = 0; p < LOUDNESS_TP_PHASES; p++) {
+            const float *c = &polyphase[p * LOUDNESS_TP_TAPS];
+            float y = 0;
+            for (size_t k = 0; k < LOUDNESS_TP_TAPS; k++)
+                y += c[k] * h[LOUDNESS_TP_TAPS - 1 - k];
+            y = fabs(y);
+            if (y > blockPeak) blockPeak = y;
+        }
+        if (blockPeak > peak) peak = blockPeak;
+    }
+
+    size_t          samplefreq;
+    bool            truePeakOn;
+    float           invFullScale;
+
+    Biquad          shelf;
+    Biquad          highpass;
+
+    size_t          blockLen;
+    size_t          blockFill;
+    double          blockSum;
+    double          blocks[LOUDNESS_BLOCKS];
+    size_t          blockPos;
+    size_t          numBlocks;
+
+    double          *histEnergy;
+    uint32_t        *momentaryHist;
+    uint32_t        *shortTermHist;
+
+    float           *polyphase;
+    float           tpHistory[2 * LOUDNESS_TP_TAPS];
+    size_t          tpPos;
+    float           blockPeak;
+    float           peak;
+};
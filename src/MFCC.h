@@ -27,6 +27,11 @@
 //=======================================================================
 // class for calculating Mel Frequency Cepstral Coefficients
 //
+// Besides the mel triangles, the filterbank can be Bark or ERB spaced with gammatone
+// shaped weights, giving BFCC's / GFCC's. The filters are stored dense, but each keeps
+// its first and last non-zero bin and only that range is summed; the DCT uses a cosine
+// table, so each scale costs the same per frame.
+//
 class MFCC
 {
 
@@ -36,9 +41,9 @@ public:
     /** Constructor */
     // framesize = twice the number of Bins (FFT)
     // 
-    MFCC (int frameSize_, size_t samplingFrequency_, size_t numCoefficents_ = 13) :    
+    MFCC (int frameSize_, size_t samplingFrequency_, size_t numCoefficents_ = 13, FilterbankScale scale_ = MelScale) :    
             frameSize(frameSize_),samplingFrequency(samplingFrequency_), numCoefficents(numCoefficents_),
-            magnitudeSpectrumSize(frameSize/2), minFrequency(0), maxFrequency(samplingFrequency)
+            magnitudeSpectrumSize(frameSize/2), minFrequency(0), maxFrequency(samplingFrequency), scale(scale_)
     {
         magnitudeSpectrumSize = frameSize/2;
         minFrequency = 0;
@@ -51,13 +56,24 @@ public:
         filterBank = new float*[numCoefficents];
         for(int i = 0; i < numCoefficents; i++)
             filterBank[i] = new float[magnitudeSpectrumSize];
+        filterStart = new int[numCoefficents];
+        filterEnd = new int[numCoefficents];
+        dctTable = new float[numCoefficents * numCoefficents];
 
-        calculateMelfilterBank();
+        if (scale == MelScale)
+            calculateMelfilterBank();
+        else
+            calculateGammatoneFilterBank();
+        calculateFilterSupport();
+        calculateDctTable();
     }
     
     // cleanup, reverse order to prevent fragmentation
     ~MFCC()
     {
+        delete[] dctTable;
+        delete[] filterEnd;
+        delete[] filterStart;
         for(int i = numCoefficents-1; i>= 0; i--)
             delete[] filterBank[i];
         delete[] filterBank;
@@ -68,20 +84,21 @@ public:
     
     //=======================================================================
     /** Calculates the Mel Frequency Cepstral Coefficients from the magnitude spectrum of a signal. The result
-     * is stored in the public vector MFCCs.
+     * is stored in the public vector MFCCs, or in out if given.
      * 
      * Note that the magnitude spectrum passed to the function is not the full mirrored magnitude spectrum, but 
      * only the first half. The frame size passed to the constructor should be twice the length of the magnitude spectrum.
      * @param magnitudeSpectrum the magnitude spectrum in vector format
+     * @param out numCoefficents floats for the result, default MFCCs
      */
-    void calculateMelFrequencyCepstralCoefficients (const float magnitudeSpectrum[])
+    void calculateMelFrequencyCepstralCoefficients (const float magnitudeSpectrum[], float *out = nullptr)
     {
         calculateMelFrequencySpectrum (magnitudeSpectrum);
         
         for (size_t i = 0; i <numCoefficents; i++)
-            MFCCs[i] = log (melSpectrum[i] + (float)FLT_MIN);
+            dctSignal[i] = log (melSpectrum[i] + (float)FLT_MIN);
 
-        discreteCosineTransform ();
+        discreteCosineTransform (out ? out : MFCCs);
     }
 
     /** Calculates the magnitude spectrum on a Mel scale. The result is stored in
@@ -92,9 +109,10 @@ public:
         for (int i = 0; i < numCoefficents; i++)
         {
             double coeff = 0;
+            const float *filter = filterBank[i];
             
-            for (size_t j = 0; j < magnitudeSpectrumSize; j++)
-                coeff += (float)((magnitudeSpectrum[j] * magnitudeSpectrum[j]) * filterBank[i][j]);
+            for (int j = filterStart[i]; j < filterEnd[i]; j++)
+                coeff += (float)((magnitudeSpectrum[j] * magnitudeSpectrum[j]) * filter[j]);
             
             melSpectrum[i] = coeff;
         }
@@ -111,33 +129,93 @@ public:
 
 private:
 
-    /** Calculates the discrete cosine transform (version 2) of an input signal, performing it in place
-     * (i.e. the result is stored in the vector passed to the function)
+    /** Calculates the discrete cosine transform (version 2) of the log mel spectrum in dctSignal
+     * the result is stored in the vector passed to the function
      *
      */
-    void discreteCosineTransform ()
+    void discreteCosineTransform (float *out)
     {
-            
-        for (size_t i = 0; i < numCoefficents; i++)
-            dctSignal[i] = MFCCs[i];
-        
-        float N = (float)numCoefficents;
-        float piOverN = M_PI / N;
-
         for (size_t k = 0; k < numCoefficents; k++)
         {
         float sum = 0;
-        float kVal = (float)k;
+        const float *cosines = &dctTable[k * numCoefficents];
 
             for (size_t n = 0; n < numCoefficents; n++)
+                sum += dctSignal[n] * cosines[n];
+
+            out[k] = 2 * sum;
+        }
+    }
+
+    /** the cosines of the DCT-II, calculated once */
+    void calculateDctTable()
+    {
+        float piOverN = M_PI / (float)numCoefficents;
+
+        for (int k = 0; k < numCoefficents; k++)
+            for (int n = 0; n < numCoefficents; n++)
+                dctTable[k * numCoefficents + n] = cos (piOverN * (((float)n) + 0.5) * (float)k);
+    }
+
+    /** finds the first and last non-zero weight of each filter, so the projection only visits those bins */
+    void calculateFilterSupport()
+    {
+        for (int i = 0; i < numCoefficents; i++)
+        {
+            int first = magnitudeSpectrumSize, last = 0;
+            for (int j = 0; j < magnitudeSpectrumSize; j++)
             {
-                float tmp = piOverN * (((float)n) + 0.5) * kVal;
-                sum += dctSignal[n] * cos (tmp);
+                if (filterBank[i][j] != 0.0)
+                {
+                    if (j < first) first = j;
+                    last = j + 1;
+                }
             }
+            filterStart[i] = (first < last) ? first : 0;
+            filterEnd[i] = last;
+        }
+    }
 
-            MFCCs[k] = 2 * sum;
+    /** Calculates gammatone shaped filters with centres equally spaced on the Bark or ERB-rate scale.
+     * The weight is the power response of a 4th order gammatone, (1 + ((f - fc) / b)^2)^-4 with
+     * b = 1.019 ERB(fc), cut off below 1e-3 to keep the filters sparse.
+     */
+    void calculateGammatoneFilterBank()
+    {
+        float lowScale = frequencyToScale (minFrequency);
+        float highScale = frequencyToScale (maxFrequency);
+        float binWidth = (float)samplingFrequency / frameSize;
+
+        for (int i = 0; i < numCoefficents; i++)
+        {
+            float centre = scaleToFrequency (lowScale + (i + 1) * (highScale - lowScale) / (numCoefficents + 1));
+            float b = 1.019 * 24.7 * (4.37 * centre / 1000.0 + 1.0);
+
+            for (int j = 0; j < magnitudeSpectrumSize; j++)
+            {
+                float x = (j * binWidth - centre) / b;
+                float g = 1.0 / (1.0 + x * x);
+                g = g * g;
+                g = g * g;
+                filterBank[i][j] = (g < 1e-3) ? 0.0 : g;
+            }
         }
     }
+
+    /** Bark (Traunmueller) or ERB-rate of a frequency in Hz */
+    float frequencyToScale (float frequency)
+    {
+        if (scale == BarkScale)
+            return 26.81 * frequency / (1960.0 + frequency) - 0.53;
+        return 21.4 * log10 (1.0 + 0.00437 * frequency);
+    }
+
+    float scaleToFrequency (float value)
+    {
+        if (scale == BarkScale)
+            return 1960.0 * (value + 0.53) / (26.28 - value);
+        return (pow (10.0, value / 21.4) - 1.0) / 0.00437;
+    }
     /** Calculates the triangular filters used in the algorithm. These will be different depending
      * upon the frame size, sampling frequency and number of coefficients and so should be re-calculated
      * should any of those parameters change.
@@ -211,8 +289,16 @@ private:
     /** the maximum frequency to be used in the calculation of MFCCs */
     float maxFrequency;
 
+    /** the frequency scale of the filterbank */
+    FilterbankScale scale;
+
     /** a vector of vectors to hold the values of the triangular filters */
     float ** filterBank;
+    /** the first and last + 1 non-zero bin of each filter */
+    int *filterStart;
+    int *filterEnd;
+    /** numCoefficents x numCoefficents DCT cosines */
+    float *dctTable;
     // 2D vector filterBank;
     float *dctSignal;
 };
\ No newline at end of file
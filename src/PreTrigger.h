@@ -0,0 +1,192 @@
+//=======================================================================
+/** @file PreTrigger.h
+ *  @brief Pre-trigger ring buffer: raw audio before and after a detection event
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// All input samples go into a ring of preSamples + postSamples, as 16 bit or, at half the
+// memory, as 8 bit G.711 mu-law (about 38 dB SNR, fine for listening and most features).
+// trigger() marks the event. Once postSamples more have arrived the ring freezes and
+// Ready is set: the window is then [event - preSamples, event + postSamples).
+//
+// The window is handed out in place as at most two spans (the ring wraps), no copy. It
+// stays valid until release(), in the meantime new samples are dropped (Dropped counts
+// them) and the history starts over after release. sample() / read() decode, for mu-law
+// as well as for 16 bit.
+//
+//   Capture.addSamples(Samples, 1024);
+//   if (dB > 80) Capture.trigger();
+//   if (Capture.Ready) { ... Capture.First / Capture.Second ... ; Capture.release(); }
+//
+
+#define PRETRIGGER_MULAW_BIAS   0x84
+#define PRETRIGGER_MULAW_CLIP   32635
+
+// a contiguous part of the window, Length samples of 1 (mu-law) or 2 bytes
+struct SampleSpan {
+  const uint8_t   *Data;
+  size_t          Length;
+};
+
+class PreTrigger
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param preSamples_ samples kept from before the trigger
+     * @param postSamples_ samples collected after the trigger
+     * @param mulaw_ store 8 bit mu-law instead of 16 bit
+     */
+    PreTrigger(size_t preSamples_, size_t postSamples_, bool mulaw_ = false) :
+            preSamples(preSamples_), postSamples(postSamples_), mulaw(mulaw_)
+    {
+        capacity = preSamples + postSamples;
+        width = mulaw ? 1 : 2;
+        ring = new uint8_t[capacity * width];
+        release();
+    }
+
+    ~PreTrigger()
+    {
+        delete[] ring;
+    }
+
+    //=======================================================================
+    /** add input, integer samples are shifted right by shift first (e.g. 16 for 32 bit I2S)
+     * @returns the number of samples stored, less than n when the ring froze
+     */
+    template <class S>
+    size_t addSamples(const S *samples, size_t n, unsigned shift = 0)
+    {
+        size_t i = 0;
+        for (; i < n && !Ready; i++) {
+            int32_t v = (int32_t)samples[i] >> shift;
+            if (v > 32767) v = 32767;
+            if (v < -32768) v = -32768;
+
+            if (mulaw) ring[head] = encode(v);
+            else       memcpy(&ring[head * 2], &v, 2);     // little endian, low half
+            if (++head == capacity) head = 0;
+            if (filled < capacity) filled++;
+
+            if (triggered && ++post == postSamples) freeze();
+        }
+        Dropped += n - i;
+        return i;
+    }
+
+    /** mark the event. Ignored while a window is being collected or held */
+    void trigger()
+    {
+        if (triggered || Ready) return;
+        triggered = true;
+        post = 0;
+        if (postSamples == 0) freeze();
+    }
+
+    /** hand the window back, collecting resumes. Samples were dropped while the window was
+     * held, so the history restarts empty: a window never spans that gap */
+    void release()
+    {
+        Ready = false;
+        triggered = false;
+        head = 0;
+        filled = 0;
+        First.Data = Second.Data = nullptr;
+        First.Length = Second.Length = 0;
+        Length = 0;
+    }
+
+    //=======================================================================
+    /** sample i of the window as 16 bit */
+    int16_t sample(size_t i)
+    {
+        const SampleSpan &s = (i < First.Length) ? First : Second;
+        if (i >= First.Length) i -= First.Length;
+        if (mulaw) return decode(s.Data[i]);
+        int16_t v;
+        memcpy(&v, &s.Data[i * 2], 2);
+        return v;
+    }
+
+    /** copy / decode part of the window, returns the number of samples */
+    size_t read(int16_t *out, size_t offset, size_t n)
+    {
+        if (offset >= Length) return 0;
+        if (n > Length - offset) n = Length - offset;
+        for (size_t i = 0; i < n; i++) out[i] = sample(offset + i);
+        return n;
+    }
+
+    static inline uint8_t encode(int32_t v)
+    {
+        uint8_t sign = 0;
+        if (v < 0) { v = -v; sign = 0x80; }
+        if (v > PRETRIGGER_MULAW_CLIP) v = PRETRIGGER_MULAW_CLIP;
+        v += PRETRIGGER_MULAW_BIAS;
+
+        uint8_t exponent = 7;
+        for (int32_t mask = 0x4000; exponent > 0 && !(v & mask); mask >>= 1) exponent--;
+        uint8_t mantissa = (v >> (exponent + 3)) & 0x0F;
+        return ~(sign | (exponent << 4) | mantissa);
+    }
+
+    static inline int16_t decode(uint8_t u)
+    {
+        u = ~u;
+        int32_t v = ((((int32_t)u & 0x0F) << 3) + PRETRIGGER_MULAW_BIAS) << ((u >> 4) & 0x07);
+        return (u & 0x80) ? PRETRIGGER_MULAW_BIAS - v : v - PRETRIGGER_MULAW_BIAS;
+    }
+
+    /** the window is complete and frozen */
+    volatile bool   Ready = false;
+    /** the window in place, oldest first, and its length in samples */
+    SampleSpan      First;
+    SampleSpan      Second;
+    size_t          Length = 0;
+    /** index of the trigger in the window, less than preSamples with too little history */
+    size_t          TriggerIndex = 0;
+    /** samples not stored while a window was held */
+    uint32_t        Dropped = 0;
+
+private:
+    // the oldest sample is at head when the ring is full, else at 0
+    void freeze()
+    {
+        size_t start = (filled < capacity) ? 0 : head;
+        Length = filled;
+        TriggerIndex = Length - postSamples;
+
+        First.Data = &ring[start * width];
+        First.Length = (start + Length <= capacity) ? Length : capacity - start;
+        Second.Data = ring;
+        Second.Length = Length - First.Length;
+        Ready = true;
+    }
+
+    size_t          preSamples;
+    size_t          postSamples;
+    bool            mulaw;
+    size_t          capacity;
+    size_t          width;
+    uint8_t         *ring;
+    size_t          head = 0;
+    size_t          filled = 0;
+    size_t          post = 0;
+    bool            triggered = false;
+};
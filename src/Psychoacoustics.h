@@ -0,0 +1,147 @@
+//=======================================================================
+/** @file Psychoacoustics.h
+ *  @brief Zwicker loudness (sone) and sharpness (acum) from the spectrum
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// A per-frame approximation of the Zwicker model (DIN 45631 / ISO 532-1), steady sounds:
+//  - one pass over the Bins: every bin adds its calibrated power (Pa^2) to its critical band,
+//    through a precomputed bin -> band map and bin scale
+//  - excitation per band is the maximum of the band itself and the masking slopes of the
+//    other bands, from a precomputed spreading table (Schroeder)
+//  - specific loudness N'(z) = 0.0635 10^(0.025 LTQ) ((1 - s + s 10^((E - LTQ) / 10))^0.25 - 1), s = 0.25
+//  - loudness N = sum N'(z), sharpness S = 0.11 sum N'(z) g(z) z / N  (DIN 45692 weighting)
+//
+// The calibration (sensitivity, gain) comes from the AnalyzerConfig, as for decibelSPL.
+// 24 bands of 1 Bark instead of the 240 of the standard, fine for features, not for certification.
+//
+
+#define PSYCHO_BANDS            24
+
+// upper edges of the critical bands in Hz
+#define PSYCHO_BAND_EDGES   { 100, 200, 300, 400, 510, 630, 770, 920, 1080, 1270, 1480, 1720, \
+                              2000, 2320, 2700, 3150, 3700, 4400, 5300, 6400, 7700, 9500, 12000, 15500 }
+
+// threshold in quiet per critical band, dB SPL
+#define PSYCHO_LTQ          { 30, 18, 12, 8, 7, 6, 5, 4, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 5, 7, 10, 15, 25 }
+
+class Psychoacoustics
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param cfg analyzer config: fftlength, samplefreq, sensitivity and gain
+     */
+    Psychoacoustics(const AnalyzerConfig &cfg) : numBins(cfg.fftlength / 2)
+    {
+        const float edges[PSYCHO_BANDS] = PSYCHO_BAND_EDGES;
+        const float ltq[PSYCHO_BANDS] = PSYCHO_LTQ;
+        float Fr = (float)cfg.samplefreq / cfg.fftlength;
+
+        binBand = new int8_t[numBins];
+        int band = 0;
+        for (size_t k = 0; k < numBins; k++) {
+            float f = k * Fr;
+            while (band < PSYCHO_BANDS && f >= edges[band]) band++;
+            binBand[k] = (k == 0 || band >= PSYCHO_BANDS) ? -1 : band;
+        }
+
+        // magnitude -> amplitude in mV as Analyzer::amplitude, -> rms^2, -> Pa^2 as decibelSPL
+        double amp = FFT_AMP_SCALE_FACTOR / cfg.fftlength;
+        double pa  = pow(10.0, -(double)cfg.gain / 20.0) / cfg.sensitivity;
+        binScale = amp * amp * 0.5 * pa * pa;
+
+        // thresholds as intensity relative to 20 uPa, and the constant of N'
+        for (int z = 0; z < PSYCHO_BANDS; z++) {
+            threshold[z] = pow(10.0, ltq[z] / 10.0);
+            factor[z] = 0.0635 * pow(10.0, 0.025 * ltq[z]);
+        }
+
+        // spreading, dz = masked band - masking band, in intensity
+        for (int dz = -(PSYCHO_BANDS - 1); dz < PSYCHO_BANDS; dz++) {
+            double x = dz + 0.474;
+            double db = 15.81 + 7.5 * x - 17.5 * sqrt(1 + x * x);
+            spread[dz + PSYCHO_BANDS - 1] = pow(10.0, db / 10.0);
+        }
+        spread[PSYCHO_BANDS - 1] = 1.0;
+
+        for (int z = 0; z < PSYCHO_BANDS; z++) {
+            float b = z + 0.5;
+            float g = (b <= 15.8) ? 1.0 : 0.15 * exp(0.42 * (b - 15.8)) + 0.85;
+            sharpWeight[z] = g * b;
+        }
+    }
+
+    ~Psychoacoustics()
+    {
+        delete[] binBand;
+    }
+
+    //=======================================================================
+    /** calculate loudness and sharpness of a magnitude spectrum (the Bins after doFft)
+     * @returns the loudness in sone, sharpness in Sharpness, per band in SpecificLoudness
+     */
+    float calculate(const float *bins)
+    {
+        double intensity[PSYCHO_BANDS] = { 0 };
+
+        for (size_t k = 1; k < numBins; k++) {
+            int b = binBand[k];
+            if (b >= 0) intensity[b] += (double)bins[k] * bins[k];
+        }
+        // to intensity relative to (20 uPa)^2
+        for (int z = 0; z < PSYCHO_BANDS; z++) intensity[z] *= binScale / 4e-10;
+
+        double total = 0, sharp = 0;
+        for (int z = 0; z < PSYCHO_BANDS; z++) {
+            double e = 0;
+            const double *s = &spread[z + PSYCHO_BANDS - 1];
+            for (int j = 0; j < PSYCHO_BANDS; j++) {
+                double m = intensity[j] * s[-j];
+                if (m > e) e = m;
+            }
+
+            double n = factor[z] * (pow(0.75 + 0.25 * e / threshold[z], 0.25) - 1.0);
+            if (n < 0) n = 0;
+            SpecificLoudness[z] = n;
+            total += n;
+            sharp += n * sharpWeight[z];
+        }
+
+        Loudness = total;
+        Sharpness = (total > 0) ? 0.11 * sharp / total : 0;
+        LoudnessLevel = (total >= 1) ? 40 + 10 * log2(total) : 40 * pow(total + 0.0005, 0.35);
+        return Loudness;
+    }
+
+    /** the loudness in sone, loudness level in phon, sharpness in acum */
+    float           Loudness = 0;
+    float           LoudnessLevel = 0;
+    float           Sharpness = 0;
+    /** specific loudness per critical band, sone / Bark */
+    float           SpecificLoudness[PSYCHO_BANDS];
+
+private:
+    size_t          numBins;
+    int8_t          *binBand;
+    double          binScale;
+    double          threshold[PSYCHO_BANDS];
+    double          factor[PSYCHO_BANDS];
+    double          spread[2 * PSYCHO_BANDS - 1];
+    float           sharpWeight[PSYCHO_BANDS];
+};
@@ -0,0 +1,200 @@
+//=======================================================================
+/** @file ResultCache.h
+ *  @brief Analysis results cached on a filesystem, by content and config hash
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// A result is valid as long as the audio, the AnalyzerConfig and the feature code are
+// the same. The key is made of all three:
+//  - content hash: 64 bit FNV-1a over the raw file bytes, so no decoding and no FFT
+//  - config hash: every config field by value, the ranges by content, never padding or pointers
+//  - ANALYZER_FEATURE_VERSION, bumped whenever a feature calculation changes
+//
+// Entries are files <dir>/<key in hex>.rc: a header with the three parts (checked on
+// lookup, a key collision is a miss) and the payload, whatever the caller wrote, e.g. a
+// FeatureCodec log. New entries are written as .tmp and renamed on commit, so a reset
+// halfway never leaves a truncated result behind.
+//
+//   uint64_t content = ResultCache::contentHash(wav), config = ResultCache::configHash(Config);
+//   if (Cache.lookup(content, config, result)) { ... read the payload ... }
+//   else { fs::File out = Cache.create(content, config); ... write ...; Cache.commit(out, content, config); }
+//
+
+#define RESULTCACHE_MAGIC       "RCAC"
+#define RESULTCACHE_HEADERLEN   24          // magic, version, content hash, config hash
+#define RESULTCACHE_SEED        0xcbf29ce484222325ULL
+#define RESULTCACHE_PRIME       0x100000001b3ULL
+#define RESULTCACHE_MAXPATH     64
+#define RESULTCACHE_CHUNK       512
+
+class ResultCache
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param fs_ filesystem for the entries
+     * @param dir_ directory, created if needed
+     */
+    ResultCache(fs::FS &fs_, const char *dir_) : fs(fs_)
+    {
+        strncpy(dir, dir_, RESULTCACHE_MAXPATH - 22);
+        dir[RESULTCACHE_MAXPATH - 22] = 0;
+        fs.mkdir(dir);
+    }
+
+    //=======================================================================
+    // keys
+
+    /** FNV-1a, continue a hash by passing the previous one as h */
+    static uint64_t hash(const void *data, size_t len, uint64_t h = RESULTCACHE_SEED)
+    {
+        const uint8_t *p = (const uint8_t *)data;
+        for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * RESULTCACHE_PRIME;
+        return h;
+    }
+
+    /** hash of all bytes of a file, the file is rewound afterwards */
+    static uint64_t contentHash(fs::File &f)
+    {
+        uint8_t buf[RESULTCACHE_CHUNK];
+        uint64_t h = RESULTCACHE_SEED;
+        size_t n;
+        f.seek(0);
+        while ((n = f.read(buf, sizeof(buf))) > 0) h = hash(buf, n, h);
+        f.seek(0);
+        return h;
+    }
+
+    /** canonical hash of the config. Extra parameters of the caller (hop, steps) can go in seed */
+    static uint64_t configHash(const AnalyzerConfig &cfg, uint64_t seed = RESULTCACHE_SEED)
+    {
+        uint64_t h = seed;
+        h = value(h, cfg.samplefreq);
+        h = value(h, cfg.fftlength);
+        h = value(h, cfg.sensitivity);
+        h = value(h, (unsigned)cfg.gain);
+        h = value(h, cfg.roloffpercentile);
+        h = value(h, cfg.numranges);
+        for (unsigned i = 0; i < cfg.numranges && cfg.ranges; i++) h = value(h, cfg.ranges[i]);
+        h = value(h, cfg.fuzzfactor);
+        h = value(h, cfg.mfcccoeff);
+        h = value(h, (unsigned)cfg.filterbank);
+        h = value(h, cfg.lpcorder);
+        h = value(h, cfg.dwtlevels);
+        h = value(h, (unsigned)cfg.wavelet);
+        h = value(h, cfg.cepstrumpeaks);
+        h = value(h, cfg.inputshift);
+        h = value(h, cfg.inputoffset);
+        h = value(h, cfg.inputscale);
+        return h;
+    }
+
+    //=======================================================================
+    // entries
+
+    /** open a cached result
+     * @param result the entry, positioned at the payload, on a hit
+     * @returns true on a hit
+     */
+    bool lookup(uint64_t content, uint64_t config, fs::File &result)
+    {
+        char path[RESULTCACHE_MAXPATH];
+        entryPath(path, content, config, "rc");
+        if (fs.exists(path)) {
+            result = fs.open(path, FILE_READ);
+            uint8_t hdr[RESULTCACHE_HEADERLEN], expect[RESULTCACHE_HEADERLEN];
+            header(expect, content, config);
+            if (result && result.read(hdr, sizeof(hdr)) == sizeof(hdr) && !memcmp(hdr, expect, sizeof(hdr))) {
+                Hits++;
+                return true;
+            }
+            result.close();
+        }
+        Misses++;
+        return false;
+    }
+
+    bool contains(uint64_t content, uint64_t config)
+    {
+        fs::File f;
+        bool hit = lookup(content, config, f);
+        f.close();
+        return hit;
+    }
+
+    /** start a new entry, write the payload into the returned file, then commit() */
+    fs::File create(uint64_t content, uint64_t config)
+    {
+        char path[RESULTCACHE_MAXPATH];
+        entryPath(path, content, config, "tmp");
+        fs::File f = fs.open(path, FILE_WRITE);
+        if (f) {
+            uint8_t hdr[RESULTCACHE_HEADERLEN];
+            header(hdr, content, config);
+            f.write(hdr, sizeof(hdr));
+        }
+        return f;
+    }
+
+    /** close the new entry and make it visible */
+    bool commit(fs::File &f, uint64_t content, uint64_t config)
+    {
+        char tmp[RESULTCACHE_MAXPATH], path[RESULTCACHE_MAXPATH];
+        f.close();
+        entryPath(tmp, content, config, "tmp");
+        entryPath(path, content, config, "rc");
+        fs.remove(path);
+        return fs.rename(tmp, path);
+    }
+
+    bool remove(uint64_t content, uint64_t config)
+    {
+        char path[RESULTCACHE_MAXPATH];
+        entryPath(path, content, config, "rc");
+        return fs.remove(path);
+    }
+
+    uint32_t        Hits = 0;
+    uint32_t        Misses = 0;
+
+private:
+    static inline uint64_t value(uint64_t h, unsigned v)    { return hash(&v, sizeof(v), h); }
+    static inline uint64_t value(uint64_t h, float v)       { return hash(&v, sizeof(v), h); }
+
+    static void header(uint8_t *hdr, uint64_t content, uint64_t config)
+    {
+        memcpy(hdr, RESULTCACHE_MAGIC, 4);
+        FeatureCodec::put32(&hdr[4], ANALYZER_FEATURE_VERSION);
+        FeatureCodec::put32(&hdr[8],  (uint32_t)content);
+        FeatureCodec::put32(&hdr[12], (uint32_t)(content >> 32));
+        FeatureCodec::put32(&hdr[16], (uint32_t)config);
+        FeatureCodec::put32(&hdr[20], (uint32_t)(config >> 32));
+    }
+
+    // the key mixes the three parts, the version changes every key
+    void entryPath(char *path, uint64_t content, uint64_t config, const char *ext)
+    {
+        uint32_t version = ANALYZER_FEATURE_VERSION;
+        uint64_t key = hash(&config, sizeof(config), hash(&version, sizeof(version), content));
+        snprintf(path, RESULTCACHE_MAXPATH, "%s/%08lx%08lx.%s", dir,
+                 (unsigned long)(key >> 32), (unsigned long)(key & 0xFFFFFFFF), ext);
+    }
+
+    fs::FS          &fs;
+    char            dir[RESULTCACHE_MAXPATH];
+};
@@ -22,11 +22,25 @@
 #pragma once
 #include <Arduino.h>
 #include <ESP_fft.h>
+#include <FS.h>
 
 namespace SoundAnalyzer {
+#include <AnalyzerConfig.h>
 #include <MFCC.h>
 #include <Yin.h>
-#include <AnalyzerConfig.h>
+#include <LPC.h>
+#include <DWT.h>
+#include <Cepstrum.h>
+#include <FeatureCodec.h>
+#include <FeatureStore.h>
+#include <LTSA.h>
+#include <Loudness.h>
+#include <TempoTracker.h>
+#include <HPSS.h>
+#include <LatencyHistogram.h>
+#include <FrameRing.h>
+#include <AsyncReader.h>
+#include <PreTrigger.h>
 
 // Config struct for the SoundAnalyzer class.
 // The constructor must take care of setting the defaults
@@ -51,9 +65,38 @@ struct AnalyzerConfig {
 
   // Mfcc parameters coeff 0 = switch off
   unsigned    mfcccoeff;
+  FilterbankScale filterbank;
+
+  // LPC parameters order 0 = switch off
+  unsigned    lpcorder;
+
+  // Wavelet parameters levels 0 = switch off
+  unsigned    dwtlevels;
+  WaveletType wavelet;
+
+  // Cepstrum parameters peaks 0 = switch off
+  unsigned    cepstrumpeaks;
+
+  // Input conversion: shift, offset and scale (to mV) of the raw samples
+  unsigned    inputshift;
+  float       inputoffset;
+  float       inputscale;
 
 };
 
+// modules that use the analyzer config
+#include <WelchPSD.h>
+#include <ZoomFFT.h>
+#include <EnvelopeSpectrum.h>
+#include <Psychoacoustics.h>
+#include <ResultCache.h>
+
+// raw sample to float. Signed integers are sign extended by the arithmetic shift, uint16_t
+// is zero extended (remove its midpoint with inputoffset), floats are taken as is
+template <class S>
+inline float shiftSample(S v, unsigned shift)     { return (float)((int32_t)v >> shift); }
+inline float shiftSample(float v, unsigned)       { return v; }
+
 // Sound Analyzer class 
 //
 template <class T> 
@@ -73,13 +116,26 @@ public:
   float           rms(const T * Signal, unsigned len=0);
   decibel_t       decibelSPL(const T * Signal, unsigned len=0); 
   float           getPitch(const T * Signal);
+  float *         getLpc(const T * Signal = nullptr);    // nullptr: the frame of the last doFft, call it right after
+  float *         getFormants();
+  float *         getWavelet(const T * Signal);
   void            doFft(const T * Signal, bool removeDC=true);
 
   float *         getFeatures(const float * Spectrum = nullptr, unsigned len = 0);
   float *         getMfcc(const float * Spectrum = nullptr, unsigned len = 0);
+  float *         getCepstrum(const float * Spectrum = nullptr, unsigned len = 0);
   signature_t *   getSignature(const float * Spectrum = nullptr, unsigned len = 0);
   hash_t          getSignatureHash(const signature_t * Signature = nullptr);
 
+  // same, but into caller buffers (NumFeatures, NumMfccCoeff, SignatureLen entries)
+  float *         getFeatures(const float * Spectrum, unsigned len, float * Out);
+  float *         getMfcc(const float * Spectrum, unsigned len, float * Out);
+  signature_t *   getSignature(const float * Spectrum, unsigned len, signature_t * Out);
+
+  // batch: frame i starts at Frames[i * hop], results into row i of the matrices (nullptr = skip)
+  size_t          analyzeBatch(const T * Frames, size_t numFrames, size_t hop, float * FeatureMatrix,
+                               float * MfccMatrix = nullptr, signature_t * SignatureMatrix = nullptr);
+
   float           frequency (unsigned bin )    {  return ( bin * Fr ); }
   float           amplitude (unsigned bin )    {  return FFT_AMP_SCALE_FACTOR * fabs(Bins[bin]) / Config.fftlength;}
   float           amplitude (float mag )       {  return FFT_AMP_SCALE_FACTOR * fabs(mag) / Config.fftlength;}
@@ -95,6 +151,22 @@ public:
   signature_t     *Signature;
   size_t          SignatureLen;
   hash_t          SignatureHash;
+  // LPC
+  float           *LpcCoeffs;
+  size_t          NumLpcCoeff;
+  float           *LpcCepstra;
+  float           *Formants;
+  size_t          NumFormants;
+  // DWT: energy per band, details level 1 (highest) .. n, approximation last
+  float           *WaveletEnergies = nullptr;
+  size_t          NumWaveletBands;
+  float           *WaveletCoeffs;
+  // Cepstrum, peaks: quefrency in ms and value, highest first
+  float           *CepstrumCoeffs;
+  size_t          NumCepstrumCoeff;
+  float           *CepstrumPeaks;
+  float           *CepstrumPeakValues;
+  size_t          NumCepstrumPeaks;
   
   // cached Freq domain features
   // enum is index
@@ -106,6 +178,10 @@ private:
   bool            Begin();
   void            End();
 
+  // the one conversion of raw samples to float, used by all time domain routines
+  inline float    sample(T v)   { return (shiftSample(v, Config.inputshift) - Config.inputoffset) * Config.inputscale; }
+  void            convert(const T * Signal, float * out, unsigned len);
+
   
 // hashing   djb2 http://www.cse.yorku.ca/~oz/hash.html
 // with fuzz factor in Hz  . we start with size_t is index+1
@@ -133,11 +209,21 @@ constexpr float scaleMag(float mag, float peak) {
 
   MFCC            *mfcc       = nullptr;
   YIN             *yin        = nullptr;
+  LPC             *lpc        = nullptr;
+  DWT             *dwt        = nullptr;
+  RealCepstrum    *cepstrum   = nullptr;
 
 };
-// instantiate for float and short int
+// instantiate for float and short int, 32 bit I2S (int32_t is int or long, depending on
+// the toolchain), packed 24 bit, and unsigned ADC samples
 template class Analyzer<int>;
+template class Analyzer<long>;
 template class Analyzer<int16_t>;
+template class Analyzer<uint16_t>;
+template class Analyzer<packed24_t>;
 template class Analyzer<float>;
 
+// modules that use the analyzer
+#include <AnalysisHub.h>
+
 } // namespace
\ No newline at end of file
@@ -0,0 +1,276 @@
+//=======================================================================
+/** @file TempoTracker.h
+ *  @brief Tempo estimation and online beat tracking from the onset envelope
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Feed the Bins of every frame (after doFft). Per frame:
+//  - onset strength = half-wave rectified log-magnitude flux, normalized by its running rms,
+//    stored in a ring of envelopeLength frames
+//  - dynamic programming beat score (Ellis 2007): score[t] = onset[t] + max over the
+//    previous half to two periods of score[t - tau] - tightness * log(tau / period)^2
+//  - beats are found by back-tracing from the best score of the last period, back to
+//    the previous beat, so in practice 1 or 2 steps
+//
+// Every envelopeLength / 8 frames the tempo is re-estimated from the autocorrelation
+// of the envelope, computed with a real FFT of twice the ring length, weighted by a
+// log-normal prior around 120 BPM.
+//
+// All costs depend on the period and the ring length, not on the length of the recording.
+//
+
+#define TEMPO_DEFAULT_ENVELOPE  512
+#define TEMPO_PRIOR_BPM         120.0
+#define TEMPO_PRIOR_OCTAVES     1.0
+#define TEMPO_TIGHTNESS         100.0
+
+class TempoTracker
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param frameRate frames per second (samplefreq / hop)
+     * @param numBins bins per frame
+     * @param envelopeLength_ length of the onset ring, power of 2
+     */
+    TempoTracker(float frameRate_, size_t numBins_, size_t envelopeLength_ = TEMPO_DEFAULT_ENVELOPE,
+                 float minBpm = 60, float maxBpm = 200) :
+            frameRate(frameRate_), numBins(numBins_), envelopeLength(envelopeLength_)
+    {
+        minLag = (size_t)floor(frameRate * 60.0 / maxBpm);
+        maxLag = (size_t)ceil(frameRate * 60.0 / minBpm);
+        if (minLag < 1) minLag = 1;
+        if (maxLag > envelopeLength / 2) maxLag = envelopeLength / 2;
+
+        prevLog  = new float[numBins];
+        envelope = new float[envelopeLength];
+        score    = new float[envelopeLength];
+        backlink = new uint32_t[envelopeLength];
+        penalty  = new float[2 * maxLag + 1];
+        prior    = new float[maxLag + 1];
+        corrIn   = new float[2 * envelopeLength];
+        corrOut  = new float[2 * envelopeLength];
+        forward  = new ESP_fft(2 * envelopeLength, (int)frameRate, FFT_REAL, FFT_FORWARD, corrIn, corrOut);
+        backward = new ESP_fft(2 * envelopeLength, (int)frameRate, FFT_REAL, FFT_BACKWARD, corrOut, corrIn);
+
+        float lag120 = frameRate * 60.0 / TEMPO_PRIOR_BPM;
+        for (size_t lag = 1; lag <= maxLag; lag++) {
+            float o = log2((float)lag / lag120) / TEMPO_PRIOR_OCTAVES;
+            prior[lag] = exp(-0.5 * o * o);
+        }
+        prior[0] = 0;
+
+        reset();
+    }
+
+    ~TempoTracker()
+    {
+        delete backward;
+        delete forward;
+        delete[] corrOut;
+        delete[] corrIn;
+        delete[] prior;
+        delete[] penalty;
+        delete[] backlink;
+        delete[] score;
+        delete[] envelope;
+        delete[] prevLog;
+    }
+
+    void reset()
+    {
+        for (size_t b = 0; b < numBins; b++) prevLog[b] = 0;
+        for (size_t i = 0; i < envelopeLength; i++) {
+            envelope[i] = 0;
+            score[i] = 0;
+            backlink[i] = NONE;
+        }
+        Frame = 0;
+        Beats = 0;
+        BeatFrame = 0;
+        lastBeat = NONE;
+        power = 1e-6;
+        setPeriod(frameRate * 60.0 / TEMPO_PRIOR_BPM);
+    }
+
+    //=======================================================================
+    /** add the magnitude spectrum of a frame
+     * @returns true when a new beat has been found, its frame number is in BeatFrame
+     */
+    bool addFrame(const float *bins)
+    {
+        // onset strength
+        float flux = 0;
+        for (size_t b = 1; b < numBins; b++) {
+            float l = log(1 + bins[b]);
+            float d = l - prevLog[b];
+            if (d > 0) flux += d;
+            prevLog[b] = l;
+        }
+        power = 0.99 * power + 0.01 * flux * flux;
+        Onset = flux / (sqrt(power) + 1e-6);
+
+        size_t   idx = Frame & (envelopeLength - 1);
+        envelope[idx] = Onset;
+
+        // DP: best predecessor between half and two periods back, within the ring
+        float    best = 0;
+        uint32_t link = NONE;
+        size_t   lo = periodFrames / 2, hi = 2 * periodFrames;
+        if (hi > envelopeLength - 1) hi = envelopeLength - 1;
+        for (size_t tau = lo; tau <= hi && tau <= Frame; tau++) {
+            float s = score[(Frame - tau) & (envelopeLength - 1)] - penalty[tau];
+            if (link == NONE || s > best) {
+                best = s;
+                link = Frame - tau;
+            }
+        }
+        score[idx] = Onset + (link != NONE && best > 0 ? best : 0);
+        backlink[idx] = (link != NONE && best > 0) ? link : NONE;
+
+        if (++sinceTempo >= envelopeLength / 8 && Frame >= envelopeLength / 2) estimateTempo();
+
+        bool beat = findBeat();
+        Frame++;
+        return beat;
+    }
+
+    /** estimated tempo in beats per minute, period in frames */
+    float           Bpm;
+    float           Period;
+    /** the onset strength of the last frame */
+    float           Onset = 0;
+    /** the number of frames seen, beats found, and the frame of the last beat */
+    uint32_t        Frame;
+    uint32_t        Beats;
+    uint32_t        BeatFrame;
+
+private:
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    void setPeriod(float period)
+    {
+        Period = period;
+        Bpm = frameRate * 60.0 / period;
+        periodFrames = (size_t)round(period);
+        if (periodFrames < 1) periodFrames = 1;
+        if (periodFrames > maxLag) periodFrames = maxLag;
+        for (size_t tau = 1; tau <= 2 * maxLag; tau++) {
+            float l = log((float)tau / period);
+            penalty[tau] = TEMPO_TIGHTNESS * l * l;
+        }
+        penalty[0] = 1e9;
+    }
+
+    // autocorrelation via |FFT|^2 of the zero padded envelope
+    void estimateTempo()
+    {
+        size_t N = 2 * envelopeLength;
+        sinceTempo = 0;
+
+        double mean = 0;
+        for (size_t i = 0; i < envelopeLength; i++) mean += envelope[i];
+        mean /= envelopeLength;
+
+        // chronological order, oldest first. Then zero padding, so no circular wrap
+        for (size_t i = 0; i < envelopeLength; i++)
+            corrIn[i] = envelope[(Frame + 1 + i) & (envelopeLength - 1)] - mean;
+        for (size_t i = envelopeLength; i < N; i++) corrIn[i] = 0;
+
+        forward->execute();
+        // power spectrum in the packed real layout [DC, Nyquist, re1, im1 ...]
+        corrOut[0] = corrOut[0] * corrOut[0];
+        corrOut[1] = corrOut[1] * corrOut[1];
+        for (size_t k = 1; k < N / 2; k++) {
+            corrOut[2*k] = corrOut[2*k] * corrOut[2*k] + corrOut[2*k+1] * corrOut[2*k+1];
+            corrOut[2*k+1] = 0;
+        }
+        backward->execute();
+
+        size_t bestLag = 0;
+        float bestVal = 0;
+        for (size_t lag = minLag; lag <= maxLag; lag++) {
+            float v = corrIn[lag] * prior[lag];
+            if (v > bestVal) {
+                bestVal = v;
+                bestLag = lag;
+            }
+        }
+        if (bestLag == 0) return;
+
+        float period = bestLag;
+        if (bestLag > minLag && bestLag < maxLag) {
+            float y1 = corrIn[bestLag - 1] * prior[bestLag - 1];
+            float y3 = corrIn[bestLag + 1] * prior[bestLag + 1];
+            float d = y1 - 2 * bestVal + y3;
+            if (d < 0) period += 0.5 * (y1 - y3) / d;
+        }
+        setPeriod(period);
+    }
+
+    // back-trace from the best score of the last period, report the first beat after lastBeat
+    // that is at least one period old, so it will not be overtaken any more
+    bool findBeat()
+    {
+        if (Frame < 2 * periodFrames) return false;
+
+        uint32_t cand = Frame;
+        float bestScore = score[Frame & (envelopeLength - 1)];
+        for (size_t i = 1; i < periodFrames; i++) {
+            float s = score[(Frame - i) & (envelopeLength - 1)];
+            if (s > bestScore) {
+                bestScore = s;
+                cand = Frame - i;
+            }
+        }
+
+        uint32_t oldest = (Frame >= envelopeLength) ? Frame - envelopeLength + 1 : 0;
+        uint32_t limit = Frame - periodFrames;
+        uint32_t found = NONE;
+        while (cand != NONE && cand >= oldest && (lastBeat == NONE || cand > lastBeat)) {
+            if (cand <= limit) found = cand;
+            cand = backlink[cand & (envelopeLength - 1)];
+        }
+
+        if (found == NONE) return false;
+        lastBeat = BeatFrame = found;
+        Beats++;
+        return true;
+    }
+
+    float           frameRate;
+    size_t          numBins;
+    size_t          envelopeLength;
+    size_t          minLag;
+    size_t          maxLag;
+    size_t          periodFrames;
+    size_t          sinceTempo = 0;
+    uint32_t        lastBeat;
+    float           power;
+
+    float           *prevLog;
+    float           *envelope;
+    float           *score;
+    uint32_t        *backlink;
+    float           *penalty;
+    float           *prior;
+    float           *corrIn;
+    float           *corrOut;
+    ESP_fft         *forward;
+    ESP_fft         *backward;
+};
@@ -0,0 +1,180 @@
+//=======================================================================
+/** @file WelchPSD.h
+ *  @brief Long-term averaged power spectral density (Welch's method)
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// Samples are cut in overlapping frames (default 50%), the mean is removed, a Hann window
+// is applied and the power spectra are summed in double. The PSD is normalized with the
+// window energy, so a white noise of variance s2 gives a flat density of s2 / (fs/2).
+//
+// Accumulators with the same configuration can be merged, e.g. when each core processed
+// half of the recordings.
+//
+// Samples are expected in mV, like the input for decibelSPL. getPSD() returns V^2/Hz,
+// or Pa^2/Hz using the microphone sensitivity and gain of the AnalyzerConfig.
+//
+
+class WelchPSD
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param cfg analyzer config: fftlength, samplefreq, sensitivity and gain are used
+     * @param hop frame advance in samples, 0 = half the fftlength, at most fftlength
+     */
+    WelchPSD(const AnalyzerConfig &cfg, size_t hop_ = 0) :
+            fftlength(cfg.fftlength), samplefreq(cfg.samplefreq), hop(hop_ ? hop_ : cfg.fftlength / 2),
+            sensitivity(cfg.sensitivity), gain(cfg.gain)
+    {
+        // 1 .. fftlength: the overlap copy in addSamples needs hop <= fftlength
+        if (hop > fftlength) hop = fftlength;
+        if (hop == 0) hop = 1;
+        NumBins = fftlength / 2 + 1;
+        Power  = new double[NumBins];
+        window = new float[fftlength];
+        frame  = new float[fftlength];
+        input  = new float[fftlength];
+        output = new float[fftlength];
+        FFT = new ESP_fft(fftlength, samplefreq, FFT_REAL, FFT_FORWARD, input, output);
+
+        // periodic Hann, the right one for overlapped frames
+        windowEnergy = 0;
+        for (size_t i = 0; i < fftlength; i++) {
+            window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / fftlength);
+            windowEnergy += (double)window[i] * window[i];
+        }
+        reset();
+    }
+
+    ~WelchPSD()
+    {
+        delete FFT;
+        delete[] output;
+        delete[] input;
+        delete[] frame;
+        delete[] window;
+        delete[] Power;
+    }
+
+    void reset()
+    {
+        for (size_t k = 0; k < NumBins; k++) Power[k] = 0;
+        Frames = 0;
+        fill = 0;
+    }
+
+    //=======================================================================
+    /** add a stream of samples, any length. Frames are processed when complete
+     */
+    template <class S>
+    void addSamples(const S *samples, size_t len)
+    {
+        while (len > 0) {
+            size_t n = fftlength - fill;
+            if (n > len) n = len;
+            for (size_t i = 0; i < n; i++) frame[fill + i] = (float)samples[i];
+            fill += n;
+            samples += n;
+            len -= n;
+
+            if (fill == fftlength) {
+                addFrame(frame);
+                // keep the overlap
+                memmove(frame, frame + hop, (fftlength - hop) * sizeof(float));
+                fill = fftlength - hop;
+            }
+        }
+    }
+
+    /** add one frame of fftlength samples, unwindowed */
+    void addFrame(const float *samples)
+    {
+        double mean = 0;
+        for (size_t i = 0; i < fftlength; i++) mean += samples[i];
+        mean /= fftlength;
+
+        for (size_t i = 0; i < fftlength; i++)
+            input[i] = (samples[i] - (float)mean) * window[i];
+
+        FFT->execute();
+
+        // real FFT layout: [DC, Nyquist, re1, im1, re2, im2 ...]
+        Power[0]           += (double)output[0] * output[0];
+        Power[NumBins - 1] += (double)output[1] * output[1];
+        for (size_t k = 1; k < NumBins - 1; k++)
+            Power[k] += (double)output[2*k] * output[2*k] + (double)output[2*k+1] * output[2*k+1];
+        Frames++;
+    }
+
+    /** add the sums of another accumulator with the same configuration */
+    bool merge(const WelchPSD &other)
+    {
+        if (other.fftlength != fftlength || other.samplefreq != samplefreq) return false;
+        for (size_t k = 0; k < NumBins; k++) Power[k] += other.Power[k];
+        Frames += other.Frames;
+        return true;
+    }
+
+    //=======================================================================
+    /** one-sided PSD, NumBins values at k * samplefreq / fftlength
+     * @param out NumBins floats
+     * @param pressure false: V^2/Hz (input in mV), true: Pa^2/Hz via sensitivity and gain
+     * @returns the number of frames averaged
+     */
+    size_t getPSD(float *out, bool pressure = false)
+    {
+        if (Frames == 0) {
+            for (size_t k = 0; k < NumBins; k++) out[k] = 0;
+            return 0;
+        }
+
+        // mV -> V, or mV -> Pa as in decibelSPL: p = (v / sensitivity) * 10^(-gain/20)
+        double unit = pressure ? pow(10.0, -(double)gain / 20.0) / sensitivity : 1e-3;
+        double scale = sq(unit) / ((double)samplefreq * windowEnergy * Frames);
+
+        out[0] = (float)(Power[0] * scale);
+        out[NumBins - 1] = (float)(Power[NumBins - 1] * scale);
+        for (size_t k = 1; k < NumBins - 1; k++)
+            out[k] = (float)(2.0 * Power[k] * scale);
+        return Frames;
+    }
+
+    float frequency(unsigned bin) { return (float)bin * samplefreq / fftlength; }
+
+    size_t          fftlength;
+    size_t          samplefreq;
+    size_t          hop;
+    size_t          NumBins;
+
+    /** summed power spectra and the number of frames */
+    double          *Power;
+    size_t          Frames;
+
+private:
+    float           sensitivity;
+    decibel_t       gain;
+
+    float           *window;
+    double          windowEnergy;
+    float           *frame;
+    size_t          fill;
+    float           *input;
+    float           *output;
+    ESP_fft         *FFT;
+};
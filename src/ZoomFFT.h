@@ -0,0 +1,210 @@
+//=======================================================================
+/** @file ZoomFFT.h
+ *  @brief High resolution spectrum of a narrow band (zoom FFT)
+ *  @author Michiel Steltman
+ *  @copyright Copyright (C) 2023 Michiel Steltman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+//=======================================================================
+//
+// The signal is mixed down with a table driven oscillator so that the band center
+// becomes 0 Hz, low-pass filtered and decimated with a windowed sinc FIR, and the
+// decimated complex signal goes through a small complex FFT. With decimation D and
+// zoomlength M the resolution is samplefreq / (D * M), the band is samplefreq / D wide.
+//
+// Example: 8192 Hz, D = 64, M = 256 gives 0.5 Hz bins over a 128 Hz band, at the cost
+// of a 256 point FFT instead of a 16384 point one.
+//
+// Magnitudes are scaled to those of the analyzer Bins with the same fftlength, so
+// Analyzer::amplitude(mag) works for both.
+//
+
+#define ZOOMFFT_OSC_BITS    10                  // oscillator table size 1024
+#define ZOOMFFT_TAPS_PER_D  8                   // FIR length = 8 * decimation + 1
+
+class ZoomFFT
+{
+public:
+    //=======================================================================
+    /** Constructor
+     * @param cfg the analyzer config, for samplefreq and fftlength (amplitude scaling)
+     * @param centerFreq center of the band in Hz
+     * @param decimation_ decimation factor, the band width is samplefreq / decimation
+     * @param zoomlength_ FFT length of the decimated signal (power of 2)
+     */
+    ZoomFFT(const AnalyzerConfig &cfg, float centerFreq, unsigned decimation_, size_t zoomlength_) :
+            samplefreq(cfg.samplefreq), fftlength(cfg.fftlength), decimation(decimation_), zoomlength(zoomlength_)
+    {
+        NumBins = zoomlength;
+        Fr = (float)samplefreq / ((float)decimation * zoomlength);
+
+        oscillator = new float[1 << ZOOMFFT_OSC_BITS];
+        taps = ZOOMFFT_TAPS_PER_D * decimation + 1;
+        fir = new float[taps];
+        histRe = new float[2 * taps];
+        histIm = new float[2 * taps];
+        window = new float[zoomlength];
+        input = new float[2 * zoomlength];
+        output = new float[2 * zoomlength];
+        Bins = new float[zoomlength];
+        FFT = new ESP_fft(zoomlength, samplefreq, FFT_COMPLEX, FFT_FORWARD, input, output);
+
+        for (size_t i = 0; i < (1u << ZOOMFFT_OSC_BITS); i++)
+            oscillator[i] = cos(2.0 * M_PI * i / (1 << ZOOMFFT_OSC_BITS));
+
+        // Blackman windowed sinc, cutoff at the edge of the decimated band, unity DC gain
+        double cutoff = 0.5 / decimation;
+        double sum = 0;
+        for (size_t i = 0; i < taps; i++) {
+            double n = (double)i - (taps - 1) / 2.0;
+            double s = (n == 0) ? 2 * cutoff : sin(2 * M_PI * cutoff * n) / (M_PI * n);
+            double w = 0.42 - 0.5 * cos(2 * M_PI * i / (taps - 1)) + 0.08 * cos(4 * M_PI * i / (taps - 1));
+            fir[i] = s * w;
+            sum += fir[i];
+        }
+        for (size_t i = 0; i < taps; i++) fir[i] /= sum;
+
+        // same window as doFft, and scale to the analyzer Bins
+        for (size_t i = 0; i < zoomlength; i++)
+            window[i] = 0.54 - 0.46 * cos(2 * M_PI * i / (zoomlength - 1));
+        scale = (float)fftlength / zoomlength;
+
+        setCenter(centerFreq);
+        reset();
+    }
+
+    ~ZoomFFT()
+    {
+        delete FFT;
+        delete[] Bins;
+        delete[] output;
+        delete[] input;
+        delete[] window;
+        delete[] histIm;
+        delete[] histRe;
+        delete[] fir;
+        delete[] oscillator;
+    }
+
+    /** move the band, keeps the filter */
+    void setCenter(float centerFreq)
+    {
+        Center = centerFreq;
+        phaseInc = (uint32_t)llround((double)centerFreq / samplefreq * 4294967296.0);
+    }
+
+    void reset()
+    {
+        for (size_t i = 0; i < 2 * taps; i++) histRe[i] = histIm[i] = 0;
+        histPos = 0;
+        phase = 0;
+        skip = 0;
+        fill = 0;
+    }
+
+    //=======================================================================
+    /** feed samples, any length
+     * @returns true when a new zoomed spectrum is available in Bins
+     */
+    template <class S>
+    bool addSamples(const S *samples, size_t len)
+    {
+        const unsigned quarter = 1 << (ZOOMFFT_OSC_BITS - 2);
+        const unsigned mask = (1 << ZOOMFFT_OSC_BITS) - 1;
+        bool ready = false;
+
+        for (size_t i = 0; i < len; i++) {
+            float x = (float)samples[i];
+            unsigned idx = phase >> (32 - ZOOMFFT_OSC_BITS);
+            phase += phaseInc;
+
+            // x * e^-jwt; sin is the cos table a quarter back
+            float re =  x * oscillator[idx];
+            float im = -x * oscillator[(idx - quarter) & mask];
+
+            // doubled ring so the FIR reads a contiguous window
+            histRe[histPos] = histRe[histPos + taps] = re;
+            histIm[histPos] = histIm[histPos + taps] = im;
+            if (++histPos == taps) histPos = 0;
+
+            if (++skip < decimation) continue;
+            skip = 0;
+
+            float accRe = 0, accIm = 0;
+            const float *hr = &histRe[histPos];
+            const float *hi = &histIm[histPos];
+            for (size_t k = 0; k < taps; k++) {
+                accRe += fir[k] * hr[k];
+                accIm += fir[k] * hi[k];
+            }
+            input[2 * fill]     = accRe * window[fill];
+            input[2 * fill + 1] = accIm * window[fill];
+
+            if (++fill == zoomlength) {
+                transform();
+                fill = 0;
+                ready = true;
+            }
+        }
+        return ready;
+    }
+
+    /** frequency of a zoomed bin, bin 0 is the lower edge of the band */
+    float frequency(unsigned bin)   { return Center + ((float)bin - (float)(zoomlength / 2)) * Fr; }
+    float amplitude(unsigned bin)   { return FFT_AMP_SCALE_FACTOR * fabs(Bins[bin]) / fftlength; }
+
+    /** the zoomed magnitude spectrum, NumBins values, lowest frequency first */
+    float           *Bins;
+    size_t          NumBins;
+    float           Fr;
+    float           Center;
+
+private:
+    void transform()
+    {
+        FFT->execute();
+
+        // rotate so the band runs from low to high
+        size_t half = zoomlength / 2;
+        for (size_t k = 0; k < zoomlength; k++) {
+            size_t src = (k + half) % zoomlength;
+            float re = output[2 * src], im = output[2 * src + 1];
+            Bins[k] = scale * sqrt(re * re + im * im);
+        }
+    }
+
+    size_t          samplefreq;
+    size_t          fftlength;
+    unsigned        decimation;
+    size_t          zoomlength;
+
+    float           *oscillator;
+    uint32_t        phase;
+    uint32_t        phaseInc;
+
+    float           *fir;
+    size_t          taps;
+    float           *histRe;
+    float           *histIm;
+    size_t          histPos;
+    unsigned        skip;
+
+    float           *window;
+    float           scale;
+    size_t          fill;
+    float           *input;
+    float           *output;
+    ESP_fft         *FFT;
+};